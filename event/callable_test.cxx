@@ -0,0 +1,81 @@
+// ../run callable event.cxx
+#include "callable.hxx"
+#include "event.hxx"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+using namespace std;
+using namespace linux::event;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    auto p = malloc(size);
+    if(p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t size) noexcept {
+    free(p);
+}
+
+constexpr int TASKS = 800;
+constexpr int WARMUP_ROUNDS = 2;
+static int executed = 0;
+static size_t allocations_before = 0;
+
+// posts TASKS tasks from inside the loop, the last one starts next round
+void post_round(event_loop& ep, int round) {
+    if(round == WARMUP_ROUNDS) {
+        allocations_before = allocations;
+    }
+    if(round > WARMUP_ROUNDS) {
+        assert(allocations == allocations_before);
+        printf("async_call without allocation passed, %d tasks\n", executed);
+        kill(getpid(), SIGUSR1);
+        return;
+    }
+    for(int i = 0; i < TASKS; ++i) {
+        ep.async_call([]() { ++executed; }, static_cast<priority>(i % 3));
+    }
+    ep.async_call([&ep, round]() { post_round(ep, round + 1); }, priority::background);
+}
+
+int main(int argc, char *argv[]) {
+    // callees are stored inline, moves transfer ownership
+    callable<int(int)> c([](int x) { return x * 2; });
+    assert(c(21) == 42);
+    string s("inline");
+    auto before = allocations;
+    callable<size_t()> by_value([s]() { return s.size(); });
+    auto moved = move(by_value);
+    assert(allocations == before);
+    assert(!by_value);
+    assert(moved() == 6);
+    printf("callable passed\n");
+
+    event_loop ep;
+    ep.set_budget(TASKS * 4, chrono::microseconds(1000000));
+    ep.async_call([&ep]() { post_round(ep, 0); });
+    ep();
+    assert(executed == TASKS * (WARMUP_ROUNDS + 1));
+    return 0;
+}
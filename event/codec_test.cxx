@@ -0,0 +1,222 @@
+// ../run codec
+#include "codec.hxx"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace linux::event;
+
+// one write per chunk, so every read_from sees exactly one chunk
+struct pipe_pair {
+    pipe_pair() {
+        assert(0 == pipe2(fds, O_NONBLOCK | O_CLOEXEC));
+    }
+    ~pipe_pair() {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    void send(const string& chunk) {
+        assert(write(fds[1], chunk.data(), chunk.size()) == static_cast<ssize_t>(chunk.size()));
+    }
+    int reader() const {
+        return fds[0];
+    }
+    int writer() const {
+        return fds[1];
+    }
+    int fds[2];
+};
+
+template<typename Codec>
+vector<string> feed(pipe_pair& p, input_buffer& in, const Codec& codec, const string& chunk) {
+    vector<string> frames;
+    p.send(chunk);
+    assert(in.read_from(p.reader(), chunk.size()) == static_cast<ssize_t>(chunk.size()));
+    dispatch(in, codec, [&frames](const frame& f) {
+            frames.push_back(string(f.data, f.size));
+        });
+    return frames;
+}
+
+string length_prefixed(const string& payload) {
+    length_prefixed_codec codec;
+    output_buffer out;
+    out.append_frame(codec, payload.data(), payload.size());
+    pipe_pair p;
+    assert(out.write_to(p.writer()));
+    string encoded(payload.size() + length_prefixed_codec::HEADER_SIZE, '\0');
+    assert(read(p.reader(), &encoded[0], encoded.size()) == static_cast<ssize_t>(encoded.size()));
+    return encoded;
+}
+
+template<typename Codec>
+bool throws(const Codec& codec, const string& data) {
+    frame f;
+    size_t scanned = 0;
+    try {
+        codec.decode(data.data(), data.size(), scanned, f);
+    } catch(const codec_exception& e) {
+        return true;
+    }
+    return false;
+}
+
+void test_length_prefixed() {
+    pipe_pair p;
+    // small on purpose, incomplete frames are moved and the buffer grows
+    input_buffer in(8);
+    length_prefixed_codec codec(1024);
+    auto hello = length_prefixed("hello");
+    assert(hello == string("\0\0\0\5hello", 9));
+
+    // header and payload split across reads
+    assert(feed(p, in, codec, hello.substr(0, 2)).empty());
+    assert(feed(p, in, codec, hello.substr(2, 4)).empty());
+    auto frames = feed(p, in, codec, hello.substr(6));
+    assert(frames.size() == 1 && frames[0] == "hello");
+    assert(in.size() == 0);
+
+    // pipelined frames in one read, the last one incomplete
+    auto empty = length_prefixed("");
+    auto big = length_prefixed(string(300, 'x'));
+    frames = feed(p, in, codec, hello + empty + hello + big.substr(0, 100));
+    assert(frames.size() == 3 && frames[0] == "hello" && frames[1].empty() && frames[2] == "hello");
+    assert(in.size() == 100);
+    frames = feed(p, in, codec, big.substr(100));
+    assert(frames.size() == 1 && frames[0] == string(300, 'x'));
+
+    // oversized frames throw as soon as the header is seen, and on encode
+    assert(throws(codec, length_prefixed(string(1025, 'y')).substr(0, 4)));
+    assert(!throws(codec, length_prefixed(string(1024, 'y'))));
+    output_buffer out;
+    auto thrown = false;
+    try {
+        out.append_frame(codec, string(1025, 'y').data(), 1025);
+    } catch(const codec_exception& e) {
+        thrown = true;
+    }
+    assert(thrown && out.empty());
+    printf("length prefixed codec passed\n");
+}
+
+void test_delimiter() {
+    pipe_pair p;
+    input_buffer in(8);
+    delimiter_codec codec("\r\n", 16);
+
+    // line and delimiter split across reads
+    assert(feed(p, in, codec, "he").empty());
+    assert(feed(p, in, codec, "llo\r").empty());
+    auto frames = feed(p, in, codec, "\nwor");
+    assert(frames.size() == 1 && frames[0] == "hello");
+    frames = feed(p, in, codec, "ld\r");
+    assert(frames.empty());
+    frames = feed(p, in, codec, "\n");
+    assert(frames.size() == 1 && frames[0] == "world");
+    assert(in.size() == 0);
+
+    // a lone first byte of the delimiter is part of the line
+    frames = feed(p, in, codec, "a\rb\r\n");
+    assert(frames.size() == 1 && frames[0] == "a\rb");
+
+    // pipelined lines in one read, the last one incomplete
+    frames = feed(p, in, codec, "one\r\n\r\ntwo\r\nthr");
+    assert(frames.size() == 3 && frames[0] == "one" && frames[1].empty() && frames[2] == "two");
+    frames = feed(p, in, codec, "ee\r\n");
+    assert(frames.size() == 1 && frames[0] == "three");
+
+    // encode appends the delimiter
+    output_buffer out;
+    out.append_frame(codec, "reply", 5);
+    assert(out.write_to(p.writer()));
+    char reply[8] = {};
+    assert(read(p.reader(), reply, sizeof(reply)) == 7 && string(reply) == "reply\r\n");
+
+    // 16 bytes is the longest line, with or without its delimiter yet
+    delimiter_codec strict("\r\n", 16);
+    assert(!throws(strict, string(16, 'z') + "\r\n"));
+    assert(!throws(strict, string(16, 'z') + "\r"));
+    assert(throws(strict, string(17, 'z') + "\r\n"));
+    delimiter_codec incomplete("\r\n", 16);
+    assert(throws(incomplete, string(19, 'z')));
+    {
+        // through dispatch, before the buffer grows without bound
+        pipe_pair q;
+        input_buffer flood(8);
+        delimiter_codec line("\n", 16);
+        auto thrown = false;
+        try {
+            feed(q, flood, line, string(32, 'z'));
+        } catch(const codec_exception& e) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    auto empty_delimiter = false;
+    try {
+        delimiter_codec none("");
+    } catch(const codec_exception& e) {
+        empty_delimiter = true;
+    }
+    assert(empty_delimiter);
+    printf("delimiter codec passed\n");
+}
+
+void test_shared_codec() {
+    // one codec for two connections, the scan position stays with each buffer
+    const delimiter_codec codec("\r\n", 64);
+    pipe_pair first_pipe;
+    pipe_pair second_pipe;
+    input_buffer first(8);
+    input_buffer second(8);
+    assert(feed(first_pipe, first, codec, "abcdefgh").empty());
+    assert(feed(second_pipe, second, codec, "x\r").empty());
+    auto frames = feed(second_pipe, second, codec, "\ny\r\n");
+    assert(frames.size() == 2 && frames[0] == "x" && frames[1] == "y");
+    frames = feed(first_pipe, first, codec, "\r");
+    assert(frames.empty());
+    assert(feed(second_pipe, second, codec, "z").empty());
+    frames = feed(first_pipe, first, codec, "\nij\r\n");
+    assert(frames.size() == 2 && frames[0] == "abcdefgh" && frames[1] == "ij");
+    frames = feed(second_pipe, second, codec, "\r\n");
+    assert(frames.size() == 1 && frames[0] == "z");
+    // consumed elsewhere, the next search starts over
+    assert(feed(first_pipe, first, codec, "k\r").empty());
+    first.consume(first.size());
+    frames = feed(first_pipe, first, codec, "\r\n");
+    assert(frames.size() == 1 && frames[0].empty());
+    printf("shared codec passed\n");
+}
+
+void test_output_buffer() {
+    pipe_pair p;
+    // fill the pipe, the rest waits for EPOLLOUT
+    auto capacity = fcntl(p.writer(), F_GETPIPE_SZ);
+    assert(capacity > 0);
+    output_buffer out;
+    string payload(capacity + 100, 'o');
+    out.append(payload.data(), payload.size());
+    assert(!out.write_to(p.writer()) && EAGAIN == errno);
+    assert(!out.empty());
+    vector<char> drained(capacity);
+    assert(read(p.reader(), drained.data(), drained.size()) == capacity);
+    assert(out.write_to(p.writer()) && out.empty());
+    assert(read(p.reader(), drained.data(), drained.size()) == 100);
+    printf("output buffer passed\n");
+}
+
+int main(int argc, char *argv[]) {
+    test_length_prefixed();
+    test_delimiter();
+    test_shared_codec();
+    test_output_buffer();
+    return 0;
+}
@@ -0,0 +1,138 @@
+// CXXSTD=c++20 ../run coroutine event.cxx
+#include "coroutine.hxx"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cassert>
+#include <cstdio>
+
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+using namespace std;
+using namespace linux::event;
+
+task<int> read_one(event_loop& ep, int fd) {
+    co_await readable(ep, fd);
+    char buf[16];
+    auto n = read(fd, buf, sizeof(buf));
+    co_return static_cast<int>(n);
+}
+
+task<int> fail() {
+    throw runtime_error("failed in task");
+    co_return 0;
+}
+
+task<void> wait_forever(event_loop& ep, int fd, bool* resumed) {
+    co_await readable(ep, fd);
+    *resumed = true;
+}
+
+// resumed in the same epoll_wait batch as victim, destroys it and reuses
+// the number of its fd before the loop gets to victim's event
+task<void> destroy_and_reuse(event_loop& ep, int fd, optional<task<void>>& victim, int victim_fd,
+                             optional<task<void>>& replacement, int* reused, bool* resumed) {
+    co_await readable(ep, fd);
+    victim.reset();
+    close(victim_fd);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, reused) == 0);
+    assert(reused[0] == victim_fd);
+    replacement.emplace(wait_forever(ep, reused[0], resumed));
+    replacement->await_suspend(noop_coroutine()).resume();
+}
+
+task<void> run_all(event_loop& ep, event_loop& other, int* sv, int* cancel_sv) {
+    auto start = chrono::steady_clock::now();
+    co_await sleep_for(ep, chrono::milliseconds(20));
+    assert(chrono::steady_clock::now() - start >= chrono::milliseconds(20));
+    printf("sleep_for passed\n");
+
+    co_await writable(ep, sv[0]);
+    assert(write(sv[0], "hello", 5) == 5);
+    auto n = co_await read_one(ep, sv[1]);
+    assert(n == 5);
+    printf("readable/writable and task<int> result passed\n");
+
+    auto caught = false;
+    try {
+        co_await fail();
+    } catch(runtime_error& e) {
+        caught = true;
+    }
+    assert(caught);
+    printf("task exception passed\n");
+
+    auto loop_thread = this_thread::get_id();
+    co_await resume_on(other);
+    assert(this_thread::get_id() != loop_thread);
+    co_await resume_on(ep);
+    assert(this_thread::get_id() == loop_thread);
+    printf("resume_on passed\n");
+
+    // destroy a task suspended on readable, the loop MUST NOT resume it
+    auto resumed = false;
+    {
+        auto t = wait_forever(ep, cancel_sv[1], &resumed);
+        t.await_suspend(noop_coroutine()).resume();
+    }
+    assert(write(cancel_sv[0], "x", 1) == 1);
+    co_await sleep_for(ep, chrono::milliseconds(20));
+    assert(!resumed);
+    printf("cancellation passed\n");
+
+    // both ready in one batch, the stale event MUST NOT wake the new waiter
+    int first[2];
+    int second[2];
+    int reused[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, first) == 0);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, second) == 0);
+    auto victim_resumed = false;
+    auto replacement_resumed = false;
+    optional<task<void>> victim(wait_forever(ep, second[1], &victim_resumed));
+    victim->await_suspend(noop_coroutine()).resume();
+    optional<task<void>> replacement;
+    auto killer = destroy_and_reuse(ep, first[1], victim, second[1], replacement, reused, &replacement_resumed);
+    killer.await_suspend(noop_coroutine()).resume();
+    // ready list order, first is returned before second
+    assert(write(first[0], "x", 1) == 1);
+    assert(write(second[0], "x", 1) == 1);
+    co_await sleep_for(ep, chrono::milliseconds(20));
+    assert(replacement.has_value());
+    assert(!victim_resumed && !replacement_resumed);
+    replacement.reset();
+    close(first[0]);
+    close(first[1]);
+    close(second[0]);
+    close(reused[0]);
+    close(reused[1]);
+    printf("stale events passed\n");
+
+    kill(getpid(), SIGUSR1);
+}
+
+int main(int argc, char *argv[]) {
+    event_loop ep;
+    event_loop other;
+    // SIGUSR1 is blocked by event_loop, the new thread inherits the mask
+    std::thread t([&other]() { other(); });
+    int sv[2];
+    int cancel_sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == 0);
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, cancel_sv) == 0);
+    spawn(ep, run_all(ep, other, sv, cancel_sv));
+    ep();
+    kill(getpid(), SIGUSR1);
+    t.join();
+    close(sv[0]);
+    close(sv[1]);
+    close(cancel_sv[0]);
+    close(cancel_sv[1]);
+    return 0;
+}
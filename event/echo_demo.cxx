@@ -0,0 +1,101 @@
+// g++ -std=c++11 -I include echo_demo.cxx event.cxx listener.cxx -o echo_demo
+// line echo server on the event library, ./echo_demo [port], SIGUSR1 stops it
+#include "codec.hxx"
+#include "event.hxx"
+#include "listener.hxx"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <utility>
+
+using namespace std;
+using namespace linux::event;
+
+class connection {
+public:
+    connection(event_loop& ep, int fd, const delimiter_codec& c): loop(ep), sockfd(fd), codec(c) {
+    }
+    connection(const connection& c) = delete;
+    connection& operator=(const connection& c) = delete;
+    ~connection() {
+        loop.unwatch(sockfd, EPOLLIN | EPOLLOUT);
+        deleter4fd()(&sockfd);
+    }
+    void wait_readable() {
+        loop.watch(sockfd, EPOLLIN, &connection::on_readable, this);
+    }
+private:
+    static void on_readable(void* arg) {
+        auto c = static_cast<connection*>(arg);
+        auto num = c->in.read_from(c->sockfd);
+        if(-1 == num && (EAGAIN == errno || EINTR == errno)) {
+            c->wait_readable();
+            return;
+        }
+        if(num <= 0) {
+            delete c;
+            return;
+        }
+        try {
+            // every complete line of this read is answered with one write
+            dispatch(c->in, c->codec, [c](const frame& f) {
+                    c->out.append_frame(c->codec, f.data, f.size);
+                });
+        } catch(codec_exception& e) {
+            delete c;
+            return;
+        }
+        c->flush();
+    }
+    static void on_writable(void* arg) {
+        static_cast<connection*>(arg)->flush();
+    }
+    void flush() {
+        if(out.write_to(sockfd)) {
+            wait_readable();
+        } else if(EAGAIN == errno) {
+            // stop reading until the peer takes the replies
+            loop.watch(sockfd, EPOLLOUT, &connection::on_writable, this);
+        } else {
+            delete this;
+        }
+    }
+    event_loop& loop;
+    int sockfd;
+    // shared by every connection, the scan position is kept by in
+    const delimiter_codec& codec;
+    input_buffer in;
+    output_buffer out;
+};
+
+int main(int argc, char *argv[]) {
+    auto port = argc > 1 ? atoi(argv[1]) : 8080;
+    printf("start, process %d, connect to port %d\n", getpid(), port);
+    try {
+        event_loop ep;
+        delimiter_codec lines("\n");
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        listener lsn(addr, [&ep, &lines](int fd) {
+                // owned by its callbacks from now on
+                (new connection(ep, fd, lines))->wait_readable();
+            });
+        ep.register_trigger(move(lsn));
+        ep();
+    } catch(event_loop_exception& e) {
+        printf("ERROR: %s\n", e.what());
+    } catch(listener_exception& e) {
+        printf("ERROR: %s\n", e.what());
+    }
+    return 0;
+}
@@ -24,8 +24,8 @@ namespace linux {
 #ifdef DEBUG
         uint32_t timer_trigger::count = 0;
 #endif
-        timer_trigger::timer_trigger(uint64_t sec, function<void()>&& tsk):
-            timerfd(-1), timerfd_raii(&timerfd), task(tsk), events(EPOLLIN) {
+        timer_trigger::timer_trigger(uint64_t sec, callback_t&& tsk):
+            timerfd(-1), timerfd_raii(&timerfd), task(move(tsk)), events(EPOLLIN) {
             if((timerfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK)) == -1) {
                 throw timer_exception(strerror(errno));
             }
@@ -61,6 +61,13 @@ namespace linux {
             tgr.events = 0;
             return *this;
         }
+        void timer_trigger::fire() const {
+            // read and discard the number of expirations
+            uint64_t value;
+            read(timerfd, &value, sizeof(value));
+            task();
+        }
+
         /*
         thread::thread(): epollfd(-1), async_eventfd(-1), sigfd(-1), 
                           epollfd_raii(&epollfd), async_eventfd_raii(&async_eventfd),
@@ -114,7 +121,7 @@ namespace linux {
             async_call(task);
         }
 
-        void thread::async_call(const function<void()>& callee) {
+        void thread::async_call(callback_t&& callee) {
 #ifdef DEBUG
             printf("async call received\n");
 #endif
@@ -158,6 +165,45 @@ namespace linux {
             }
         }*/
 
+        callback_ring::callback_ring(size_t capacity): capacity(1), head(0), count(0) {
+            while(this->capacity < capacity) {
+                this->capacity <<= 1;
+            }
+            slots.reset(new callback_t[this->capacity]);
+        }
+
+        void callback_ring::push(callback_t&& cb) {
+            if(count == capacity) {
+                grow();
+            }
+            slots[(head + count) & (capacity - 1)] = move(cb);
+            ++count;
+        }
+
+        void callback_ring::pop() {
+            // release the captures now, the slot itself is reused
+            slots[head] = nullptr;
+            head = (head + 1) & (capacity - 1);
+            --count;
+        }
+
+        void callback_ring::swap(callback_ring& r) {
+            std::swap(slots, r.slots);
+            std::swap(capacity, r.capacity);
+            std::swap(head, r.head);
+            std::swap(count, r.count);
+        }
+
+        void callback_ring::grow() {
+            unique_ptr<callback_t[]> bigger(new callback_t[capacity * 2]);
+            for(size_t i = 0; i < count; ++i) {
+                bigger[i] = move(slots[(head + i) & (capacity - 1)]);
+            }
+            slots = move(bigger);
+            capacity *= 2;
+            head = 0;
+        }
+
         void deleter4fd::operator()(int* pfd) {
 #ifdef DEBUG
             printf("release file descriptor %d\n", *pfd);
@@ -171,7 +217,9 @@ namespace linux {
 
         event_loop::event_loop(): epollfd(-1), async_eventfd(-1), sigfd(-1), 
                           epollfd_raii(&epollfd), async_eventfd_raii(&async_eventfd),
-                                  sigfd_raii(&sigfd), exit(false) {
+                                  sigfd_raii(&sigfd), exit(false),
+                                  async_queue_guard(PTHREAD_MUTEX_INITIALIZER),
+                                  task_budget(64), time_budget(500), watch_generation(0) {
             // there is race contiditon when calling strerror, using strerror_r instread
             if((epollfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
                 throw event_loop_exception(strerror(errno));
@@ -211,43 +259,208 @@ namespace linux {
 
         void event_loop::operator()() {
             while(!exit) {
-                auto ret = epoll_wait(epollfd, events, sizeof(events)/sizeof(struct epoll_event), -1);
+                // do not block if there are deferred tasks, just poll for I/O events
+                auto timeout = has_pending_tasks() ? 0 : -1;
+                // epoll re-queues level triggered ready fds at the tail of its ready
+                // list, so taking at most MAX_EVENTS per wait round-robins ready fds
+                auto ret = epoll_wait(epollfd, events, sizeof(events)/sizeof(struct epoll_event), timeout);
                 for(auto i = 0; i < ret; ++i) {
                     if(events[i].data.fd == async_eventfd) {
-                        while(!async_queue.empty()) {
-                            auto task = async_queue.front();
-                            async_queue.pop();
-                            task();
-                        }
-                        // just discard the value
+                        // read before collecting, a later async_call signals again
                         uint64_t value;
                         read(async_eventfd, &value, sizeof(value));
+                        collect_async_tasks();
                     } else if(events[i].data.fd == sigfd) {
                         exit = true;
+                    } else if(watches.count(events[i].data.fd) != 0) {
+                        dispatch_watch(events[i]);
                     } else {
-                        triggers[events[i].data.fd]->get_task()();
-                        // read and discard
-                        uint64_t value;
-                        read(events[i].data.fd, &value, sizeof(value));
+                        triggers[events[i].data.fd]->fire();
+                    }
+                }
+                run_async_tasks();
+            }
+        }
+
+        void event_loop::set_budget(uint32_t max_tasks, chrono::microseconds max_time) {
+            task_budget = max_tasks;
+            time_budget = max_time;
+        }
+
+        void event_loop::collect_async_tasks() {
+            pthread_mutex_lock(&async_queue_guard);
+            for(size_t i = 0; i < PRIORITY_LEVELS; ++i) {
+                auto& from = async_queues[i];
+                auto& to = ready_queues[i];
+                if(to.empty()) {
+                    from.swap(to);
+                    continue;
+                }
+                while(!from.empty()) {
+                    to.push(move(from.front()));
+                    from.pop();
+                }
+            }
+            pthread_mutex_unlock(&async_queue_guard);
+        }
+
+        void event_loop::run_async_tasks() {
+            auto deadline = chrono::steady_clock::now() + time_budget;
+            uint32_t count = 0;
+            for(auto& lane: ready_queues) {
+                while(!lane.empty()) {
+                    // always make progress, at least one task per iteration
+                    if(count > 0 && (count >= task_budget || chrono::steady_clock::now() >= deadline)) {
+                        return;
                     }
+                    auto task = move(lane.front());
+                    lane.pop();
+                    task();
+                    ++count;
+                }
+            }
+        }
+
+        bool event_loop::has_pending_tasks() const {
+            for(auto& lane: ready_queues) {
+                if(!lane.empty()) {
+                    return true;
                 }
             }
+            return false;
         }
 
         void event_loop::do_register(struct epoll_event ev) {
+            // fd number may be reused from a closed watched fd
+            watches.erase(ev.data.fd);
             if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, ev.data.fd, &ev)) {
                 throw event_loop_exception(strerror(errno));
             }
         }
 
-        void event_loop::async_call(function<void()>&& task) {
+        void event_loop::watch(int fd, uint32_t events, void (*resume)(void*), void* arg) {
+            auto& w = watches[fd];
+            // a new waiter, possibly on a new file behind the same number
+            w.generation = ++watch_generation;
+            if((events & EPOLLIN) != 0) {
+                w.on_readable = resume;
+                w.readable_arg = arg;
+            }
+            if((events & EPOLLOUT) != 0) {
+                w.on_writable = resume;
+                w.writable_arg = arg;
+            }
+            arm_watch(fd);
+        }
+
+        void event_loop::unwatch(int fd, uint32_t events) {
+            auto w = watches.find(fd);
+            if(w == watches.end()) {
+                return;
+            }
+            if((events & EPOLLIN) != 0) {
+                w->second.on_readable = nullptr;
+                w->second.readable_arg = nullptr;
+            }
+            if((events & EPOLLOUT) != 0) {
+                w->second.on_writable = nullptr;
+                w->second.writable_arg = nullptr;
+            }
+            // events already returned for the dropped waiter are stale
+            w->second.generation = ++watch_generation;
+            if(w->second.on_readable != nullptr || w->second.on_writable != nullptr) {
+                arm_watch(fd);
+            } else if(w->second.registered) {
+                // disable, fd may already be closed which is fine as well
+                struct epoll_event ev;
+                ev.data.u64 = watch_data(fd, w->second.generation);
+                ev.events = EPOLLONESHOT;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+            }
+        }
+
+        void event_loop::arm_watch(int fd) {
+            auto& w = watches[fd];
+            struct epoll_event ev;
+            ev.data.u64 = watch_data(fd, w.generation);
+            // one-shot, the kernel disables fd after it fires so no syscall is
+            // needed until somebody waits on it again
+            ev.events = EPOLLONESHOT;
+            if(w.on_readable != nullptr) {
+                ev.events |= EPOLLIN;
+            }
+            if(w.on_writable != nullptr) {
+                ev.events |= EPOLLOUT;
+            }
+            if(w.registered) {
+                if(0 == epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev)) {
+                    return;
+                }
+                // watched fd was closed and its number reused
+                if(ENOENT != errno) {
+                    throw event_loop_exception(strerror(errno));
+                }
+            }
+            if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev)) {
+                throw event_loop_exception(strerror(errno));
+            }
+            w.registered = true;
+        }
+
+        void event_loop::dispatch_watch(const struct epoll_event& ev) {
+            auto fd = ev.data.fd;
+            auto revents = ev.events;
+            auto& w = watches[fd];
+            // returned by the same epoll_wait before an earlier callback closed
+            // fd and a new watch reused its number, the kernel reports the new
+            // file again if it is ready
+            if(static_cast<uint32_t>(ev.data.u64 >> 32) != w.generation) {
+                return;
+            }
+            void (*on_readable)(void*) = nullptr;
+            void (*on_writable)(void*) = nullptr;
+            auto readable_arg = w.readable_arg;
+            auto writable_arg = w.writable_arg;
+            if((revents & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) {
+                on_readable = w.on_readable;
+                w.on_readable = nullptr;
+            }
+            if((revents & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0) {
+                on_writable = w.on_writable;
+                w.on_writable = nullptr;
+            }
+            // re-arm for the direction still waited on before resuming anybody
+            if(w.on_readable != nullptr || w.on_writable != nullptr) {
+                arm_watch(fd);
+            }
+            if(on_readable != nullptr) {
+                on_readable(readable_arg);
+            }
+            if(on_writable != nullptr) {
+                on_writable(writable_arg);
+            }
+        }
+
+        void event_loop::async_call(callback_t&& task, priority prio) {
 #ifdef DEBUG
             printf("async call received\n");
 #endif
-            async_queue.push(task);
-            // just put a small non-zero
-            uint64_t value = 1;
-            write(async_eventfd, &value, sizeof(value));
+            pthread_mutex_lock(&async_queue_guard);
+            // only the first task since last collection needs to wake up the loop
+            auto wakeup = true;
+            for(auto& lane: async_queues) {
+                if(!lane.empty()) {
+                    wakeup = false;
+                    break;
+                }
+            }
+            async_queues[static_cast<size_t>(prio)].push(move(task));
+            pthread_mutex_unlock(&async_queue_guard);
+            if(wakeup) {
+                // just put a small non-zero
+                uint64_t value = 1;
+                write(async_eventfd, &value, sizeof(value));
+            }
         }
     }
 }
@@ -160,7 +160,8 @@ int main(int argc, char *argv[]) {
         perror("failed to bind listening socket");
         return EXIT_FAILURE;
     }
-    constexpr int BACKLOG = 10;
+    // capped by /proc/sys/net/core/somaxconn
+    constexpr int BACKLOG = SOMAXCONN;
     if(-1 == listen(sockfd, BACKLOG)) {
         perror("failed to listening socket");
         return EXIT_FAILURE;
@@ -210,9 +211,18 @@ int main(int argc, char *argv[]) {
                 buf[sizeof(buf)-1] = '\0';
                 printf("[PID: %d] standard input ready event received, value: %s", getpid(), buf);
             } else if(sockfd == events[i].data.fd) {
-                auto cfd = accept(sockfd, nullptr, nullptr);
-                unique_ptr<int, FDDeleter> raii_cfd(&cfd);
-                printf("[PID: %d] client connection event received, connection closed\n", getpid());
+                // drain the accept queue, one event may stand for many connections
+                while(true) {
+                    auto cfd = accept4(sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if(-1 == cfd) {
+                        if(EINTR == errno || ECONNABORTED == errno) {
+                            continue;
+                        }
+                        break;
+                    }
+                    unique_ptr<int, FDDeleter> raii_cfd(&cfd);
+                    printf("[PID: %d] client connection event received, connection closed\n", getpid());
+                }
             } else {
                 printf("[PID: %d] unknown event received\n", getpid());
             }
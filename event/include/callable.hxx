@@ -0,0 +1,113 @@
+#ifndef LINUX_EVENT_CALLABLE_HXX
+#define LINUX_EVENT_CALLABLE_HXX
+
+#include <cstddef>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// inline capacity in bytes of callable, override at compile time with
+// -DLINUX_EVENT_CALLABLE_SIZE=n if bigger captures are needed
+#ifndef LINUX_EVENT_CALLABLE_SIZE
+#define LINUX_EVENT_CALLABLE_SIZE 48
+#endif
+
+namespace linux {
+    namespace event {
+
+        /****************************************************************
+         ** move only replacement of std::function, the callee is always
+         ** stored inline so construction and moves never allocate.
+         ** A callee bigger than Capacity is a compile error
+         ***************************************************************/
+        template<typename Signature, std::size_t Capacity = LINUX_EVENT_CALLABLE_SIZE>
+        class callable;
+
+        template<typename R, typename... Args, std::size_t Capacity>
+        class callable<R(Args...), Capacity> {
+        public:
+            callable() noexcept: invoker(nullptr), manager(nullptr) {
+            }
+            callable(std::nullptr_t) noexcept: invoker(nullptr), manager(nullptr) {
+            }
+            template<typename F,
+                     typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, callable>::value>::type>
+            callable(F&& f): invoker(&invoke<typename std::decay<F>::type>),
+                             manager(&manage<typename std::decay<F>::type>) {
+                typedef typename std::decay<F>::type callee_t;
+                static_assert(sizeof(callee_t) <= Capacity,
+                              "callee exceeds callable inline capacity, raise LINUX_EVENT_CALLABLE_SIZE");
+                static_assert(alignof(callee_t) <= alignof(std::max_align_t),
+                              "callee is over aligned for callable inline storage");
+                static_assert(std::is_nothrow_move_constructible<callee_t>::value,
+                              "callee MUST be nothrow move constructible");
+                new (storage) callee_t(std::forward<F>(f));
+            }
+            callable(callable&& c) noexcept: invoker(c.invoker), manager(c.manager) {
+                if(manager != nullptr) {
+                    manager(storage, c.storage);
+                    c.reset();
+                }
+            }
+            callable& operator=(callable&& c) noexcept {
+                if(this != &c) {
+                    reset();
+                    invoker = c.invoker;
+                    manager = c.manager;
+                    if(manager != nullptr) {
+                        manager(storage, c.storage);
+                        c.reset();
+                    }
+                }
+                return *this;
+            }
+            callable& operator=(std::nullptr_t) noexcept {
+                reset();
+                return *this;
+            }
+            callable(const callable& c) = delete;
+            callable& operator=(const callable& c) = delete;
+            ~callable() {
+                reset();
+            }
+            explicit operator bool() const noexcept {
+                return invoker != nullptr;
+            }
+            // const like std::function, the callee itself may be mutable
+            R operator()(Args... args) const {
+                return invoker(const_cast<unsigned char*>(storage), std::forward<Args>(args)...);
+            }
+        private:
+            typedef R (*invoker_t)(void* callee, Args&&... args);
+            // move constructs dst from src and destroys src, or only destroys
+            // src when dst is null
+            typedef void (*manager_t)(void* dst, void* src);
+
+            template<typename T>
+            static R invoke(void* callee, Args&&... args) {
+                return (*static_cast<T*>(callee))(std::forward<Args>(args)...);
+            }
+            template<typename T>
+            static void manage(void* dst, void* src) {
+                auto p = static_cast<T*>(src);
+                if(dst != nullptr) {
+                    new (dst) T(std::move(*p));
+                }
+                p->~T();
+            }
+            void reset() noexcept {
+                if(manager != nullptr) {
+                    manager(nullptr, storage);
+                }
+                invoker = nullptr;
+                manager = nullptr;
+            }
+
+            invoker_t invoker;
+            manager_t manager;
+            alignas(std::max_align_t) unsigned char storage[Capacity];
+        };
+    }
+}
+#endif
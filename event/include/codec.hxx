@@ -0,0 +1,245 @@
+#ifndef LINUX_EVENT_CODEC_HXX
+#define LINUX_EVENT_CODEC_HXX
+
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace linux {
+    namespace event {
+
+        class codec_exception: public std::runtime_error {
+        public:
+            codec_exception(const std::string& msg): runtime_error(msg) {
+            }
+        };
+
+        // a frame inside input_buffer, no copy, valid until the buffer is consumed
+        struct frame {
+            const char* data;
+            std::size_t size;
+        };
+
+        /****************************************************************
+         ** per connection input buffer, read() lands directly in it and
+         ** frames are parsed in place. Unconsumed bytes of an incomplete
+         ** frame are moved to the front only when the tail runs short.
+         ** It also keeps how far codecs have searched the incomplete
+         ** frame, so codecs hold no per connection state
+         ***************************************************************/
+        class input_buffer {
+        public:
+            explicit input_buffer(std::size_t capacity = 16 * 1024): storage(capacity), begin(0), end(0), searched(0) {
+            }
+            const char* data() const {
+                return storage.data() + begin;
+            }
+            std::size_t size() const {
+                return end - begin;
+            }
+            // the search restarts at the new front
+            void consume(std::size_t n) {
+                searched = 0;
+                begin += n;
+                if(begin == end) {
+                    begin = 0;
+                    end = 0;
+                }
+            }
+            // at least n writable bytes at the returned address
+            char* prepare(std::size_t n) {
+                if(storage.size() - end < n) {
+                    if(begin > 0) {
+                        std::memmove(storage.data(), storage.data() + begin, end - begin);
+                        end -= begin;
+                        begin = 0;
+                    }
+                    if(storage.size() - end < n) {
+                        storage.resize(end + n > storage.size() * 2 ? end + n : storage.size() * 2);
+                    }
+                }
+                return storage.data() + end;
+            }
+            void commit(std::size_t n) {
+                end += n;
+            }
+            // bytes from the front known not to complete a frame yet
+            std::size_t& scan_position() {
+                return searched;
+            }
+            // one read() of whatever fd has, result of read()
+            ssize_t read_from(int fd, std::size_t min_room = 4096) {
+                auto p = prepare(min_room);
+                auto n = read(fd, p, storage.size() - end);
+                if(n > 0) {
+                    commit(n);
+                }
+                return n;
+            }
+        private:
+            std::vector<char> storage;
+            std::size_t begin;
+            std::size_t end;
+            std::size_t searched;
+        };
+
+        // responses of a batch of frames are gathered and written at once
+        class output_buffer {
+        public:
+            output_buffer(): begin(0) {
+            }
+            bool empty() const {
+                return begin == storage.size();
+            }
+            void append(const void* data, std::size_t n) {
+                auto p = static_cast<const char*>(data);
+                storage.insert(storage.end(), p, p + n);
+            }
+            template<typename Codec>
+            void append_frame(const Codec& codec, const void* data, std::size_t n) {
+                codec.encode(*this, data, n);
+            }
+            // false if fd can't take more now, wait for EPOLLOUT then
+            bool write_to(int fd) {
+                while(!empty()) {
+                    auto n = write(fd, storage.data() + begin, storage.size() - begin);
+                    if(n < 0) {
+                        if(EINTR == errno) {
+                            continue;
+                        }
+                        return false;
+                    }
+                    begin += n;
+                }
+                storage.clear();
+                begin = 0;
+                return true;
+            }
+        private:
+            std::vector<char> storage;
+            std::size_t begin;
+        };
+
+        // 4 bytes big endian payload length, then payload. Stateless, one
+        // instance may serve every connection
+        class length_prefixed_codec {
+        public:
+            explicit length_prefixed_codec(std::uint32_t max_frame_size = 16 * 1024 * 1024): max_size(max_frame_size) {
+            }
+            // bytes taken by the first complete frame of data, 0 if incomplete.
+            // The header is cheap to parse again, scanned is left alone
+            std::size_t decode(const char* data, std::size_t size, std::size_t& scanned, frame& f) const {
+                if(size < HEADER_SIZE) {
+                    return 0;
+                }
+                auto p = reinterpret_cast<const unsigned char*>(data);
+                auto length = (static_cast<std::uint32_t>(p[0]) << 24) | (static_cast<std::uint32_t>(p[1]) << 16) |
+                              (static_cast<std::uint32_t>(p[2]) << 8) | static_cast<std::uint32_t>(p[3]);
+                if(length > max_size) {
+                    throw codec_exception("frame exceeds max frame size");
+                }
+                if(size - HEADER_SIZE < length) {
+                    return 0;
+                }
+                f.data = data + HEADER_SIZE;
+                f.size = length;
+                return HEADER_SIZE + length;
+            }
+            void encode(output_buffer& out, const void* data, std::size_t n) const {
+                if(n > max_size) {
+                    throw codec_exception("frame exceeds max frame size");
+                }
+                unsigned char header[HEADER_SIZE] = {
+                    static_cast<unsigned char>(n >> 24), static_cast<unsigned char>(n >> 16),
+                    static_cast<unsigned char>(n >> 8), static_cast<unsigned char>(n)
+                };
+                out.append(header, sizeof(header));
+                out.append(data, n);
+            }
+            constexpr static std::size_t HEADER_SIZE = 4;
+        private:
+            std::uint32_t max_size;
+        };
+
+        // frames end with delimiter, the delimiter is not part of the frame.
+        // Stateless, one instance may serve every connection
+        class delimiter_codec {
+        public:
+            explicit delimiter_codec(const std::string& delim = "\n", std::size_t max_frame_size = 64 * 1024):
+                delimiter(delim), max_size(max_frame_size) {
+                if(delimiter.empty()) {
+                    throw codec_exception("empty delimiter");
+                }
+            }
+            // bytes taken by the first complete frame of data, 0 if incomplete.
+            // scanned is where the search resumes, see input_buffer::scan_position
+            std::size_t decode(const char* data, std::size_t size, std::size_t& scanned, frame& f) const {
+                // don't rescan what a previous call has seen of the same frame
+                auto from = scanned > size ? 0 : scanned;
+                while(from + delimiter.size() <= size) {
+                    auto p = static_cast<const char*>(std::memchr(data + from, delimiter[0], size - from - delimiter.size() + 1));
+                    if(p == nullptr) {
+                        break;
+                    }
+                    if(std::memcmp(p, delimiter.data(), delimiter.size()) == 0) {
+                        scanned = 0;
+                        f.data = data;
+                        f.size = p - data;
+                        if(f.size > max_size) {
+                            throw codec_exception("frame exceeds max frame size");
+                        }
+                        return f.size + delimiter.size();
+                    }
+                    from = p - data + 1;
+                }
+                if(size > max_size + delimiter.size()) {
+                    throw codec_exception("frame exceeds max frame size");
+                }
+                scanned = size >= delimiter.size() ? size - delimiter.size() + 1 : 0;
+                return 0;
+            }
+            void encode(output_buffer& out, const void* data, std::size_t n) const {
+                out.append(data, n);
+                out.append(delimiter.data(), delimiter.size());
+            }
+        private:
+            std::string delimiter;
+            std::size_t max_size;
+        };
+
+        // hands every complete frame of in to handler in one pass, so requests
+        // of a pipelining client are served as a batch, and consumes them at
+        // once. Frames MUST NOT be used after handler returns
+        template<typename Codec, typename Handler>
+        std::size_t dispatch(input_buffer& in, const Codec& codec, Handler&& handler) {
+            auto p = in.data();
+            auto remaining = in.size();
+            // relative to p, reset by the codec once a frame is complete
+            auto scanned = in.scan_position();
+            std::size_t count = 0;
+            frame f;
+            while(remaining > 0) {
+                auto n = codec.decode(p, remaining, scanned, f);
+                if(n == 0) {
+                    break;
+                }
+                handler(f);
+                p += n;
+                remaining -= n;
+                ++count;
+            }
+            // p is the new front
+            in.consume(in.size() - remaining);
+            in.scan_position() = scanned;
+            return count;
+        }
+    }
+}
+#endif
@@ -0,0 +1,331 @@
+#ifndef LINUX_EVENT_COROUTINE_HXX
+#define LINUX_EVENT_COROUTINE_HXX
+
+// coroutine layer on top of event_loop, requires C++20
+// all awaitables MUST be awaited on the thread running the event_loop
+
+#include "event.hxx"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+#include <chrono>
+
+namespace linux {
+    namespace event {
+
+        /****************************************************************
+         ** coroutine frame pool
+         ** each event_loop runs on its own thread, so a thread local
+         ** pool is a per loop pool without any locking. Frames are
+         ** recycled by size class, bigger frames go to operator new
+         ***************************************************************/
+        class frame_pool {
+        public:
+            static void* allocate(std::size_t size) {
+                auto index = size_class(size);
+                if(index >= CLASSES) {
+                    return ::operator new(size);
+                }
+                auto& head = free_lists()[index];
+                if(head != nullptr) {
+                    auto p = head;
+                    head = p->next;
+                    return p;
+                }
+                return ::operator new((index + 1) * GRANULARITY);
+            }
+            static void deallocate(void* p, std::size_t size) {
+                auto index = size_class(size);
+                if(index >= CLASSES) {
+                    ::operator delete(p);
+                    return;
+                }
+                // frame may be released on another loop after resume_on, it
+                // simply migrates to that loop's pool
+                auto& head = free_lists()[index];
+                auto n = static_cast<free_node*>(p);
+                n->next = head;
+                head = n;
+            }
+        private:
+            struct free_node {
+                free_node* next;
+            };
+            constexpr static std::size_t GRANULARITY = 64;
+            constexpr static std::size_t CLASSES = 32;
+            static std::size_t size_class(std::size_t size) {
+                return (size + GRANULARITY - 1) / GRANULARITY - 1;
+            }
+            static free_node** free_lists() {
+                thread_local free_node* lists[CLASSES] = {};
+                return lists;
+            }
+        };
+
+        template<typename T = void>
+        class task;
+
+        namespace detail {
+            struct promise_base {
+                static void* operator new(std::size_t size) {
+                    return frame_pool::allocate(size);
+                }
+                static void operator delete(void* p, std::size_t size) {
+                    frame_pool::deallocate(p, size);
+                }
+                // lazy, starts when awaited
+                std::suspend_always initial_suspend() noexcept {
+                    return {};
+                }
+                struct final_awaiter {
+                    bool await_ready() noexcept {
+                        return false;
+                    }
+                    template<typename P>
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                        // symmetric transfer back to the awaiting coroutine
+                        auto c = h.promise().continuation;
+                        return c ? c : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {
+                    }
+                };
+                final_awaiter final_suspend() noexcept {
+                    return {};
+                }
+                void unhandled_exception() {
+                    error = std::current_exception();
+                }
+                std::coroutine_handle<> continuation;
+                std::exception_ptr error;
+            };
+
+            template<typename T>
+            struct promise: promise_base {
+                task<T> get_return_object();
+                template<typename U>
+                void return_value(U&& v) {
+                    value.emplace(std::forward<U>(v));
+                }
+                T result() {
+                    if(error) {
+                        std::rethrow_exception(error);
+                    }
+                    return std::move(*value);
+                }
+                std::optional<T> value;
+            };
+
+            template<>
+            struct promise<void>: promise_base {
+                task<void> get_return_object();
+                void return_void() {
+                }
+                void result() {
+                    if(error) {
+                        std::rethrow_exception(error);
+                    }
+                }
+            };
+        }
+
+        template<typename T>
+        class task {
+        public:
+            typedef detail::promise<T> promise_type;
+            typedef std::coroutine_handle<promise_type> handle_t;
+            explicit task(handle_t h): handle(h) {
+            }
+            task(task&& t) noexcept: handle(std::exchange(t.handle, nullptr)) {
+            }
+            task& operator=(task&& t) noexcept {
+                if(this != &t) {
+                    if(handle) {
+                        handle.destroy();
+                    }
+                    handle = std::exchange(t.handle, nullptr);
+                }
+                return *this;
+            }
+            task(const task& t) = delete;
+            task& operator=(const task& t) = delete;
+            ~task() {
+                if(handle) {
+                    handle.destroy();
+                }
+            }
+            bool await_ready() const noexcept {
+                return !handle || handle.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() {
+                return handle.promise().result();
+            }
+        private:
+            handle_t handle;
+        };
+
+        namespace detail {
+            template<typename T>
+            task<T> promise<T>::get_return_object() {
+                return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+            }
+
+            inline task<void> promise<void>::get_return_object() {
+                return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+            }
+
+            // owns itself, frame is released when the body completes
+            struct detached {
+                struct promise_type: promise_base {
+                    detached get_return_object() {
+                        return detached{std::coroutine_handle<promise_type>::from_promise(*this)};
+                    }
+                    std::suspend_never final_suspend() noexcept {
+                        return {};
+                    }
+                    void return_void() {
+                    }
+                    void unhandled_exception() {
+                        std::terminate();
+                    }
+                };
+                std::coroutine_handle<promise_type> handle;
+            };
+
+            inline detached make_detached(task<void> t) {
+                co_await t;
+            }
+
+            inline void resume_address(void* address) {
+                std::coroutine_handle<>::from_address(address).resume();
+            }
+        }
+
+        // start t on loop, it runs until completion without an owner
+        inline void spawn(event_loop& loop, task<void> t, priority prio = priority::normal) {
+            auto h = detail::make_detached(std::move(t)).handle;
+            loop.async_call([h]() { h.resume(); }, prio);
+        }
+
+        // destroying a coroutine suspended on fd cancels its watch, so the
+        // loop never resumes a dead frame
+        class io_awaiter {
+        public:
+            io_awaiter(event_loop& lp, int fd, std::uint32_t ev): loop(lp), fd(fd), events(ev), armed(false) {
+            }
+            io_awaiter(const io_awaiter& a) = delete;
+            io_awaiter& operator=(const io_awaiter& a) = delete;
+            ~io_awaiter() {
+                if(armed) {
+                    loop.unwatch(fd, events);
+                }
+            }
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                loop.watch(fd, events, &detail::resume_address, h.address());
+                armed = true;
+            }
+            void await_resume() noexcept {
+                armed = false;
+            }
+        private:
+            event_loop& loop;
+            int fd;
+            std::uint32_t events;
+            bool armed;
+        };
+
+        // resumes once fd is readable, or on error and hang up
+        inline io_awaiter readable(event_loop& loop, int fd) {
+            return io_awaiter(loop, fd, EPOLLIN);
+        }
+
+        // resumes once fd is writable, or on error and hang up
+        inline io_awaiter writable(event_loop& loop, int fd) {
+            return io_awaiter(loop, fd, EPOLLOUT);
+        }
+
+        class sleep_awaiter {
+        public:
+            sleep_awaiter(event_loop& lp, std::chrono::nanoseconds d): loop(lp), duration(d), timerfd(-1), armed(false) {
+            }
+            sleep_awaiter(const sleep_awaiter& s) = delete;
+            sleep_awaiter& operator=(const sleep_awaiter& s) = delete;
+            ~sleep_awaiter() {
+                if(armed) {
+                    loop.unwatch(timerfd, EPOLLIN);
+                }
+                deleter4fd()(&timerfd);
+            }
+            bool await_ready() const noexcept {
+                return duration.count() <= 0;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                if((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1) {
+                    throw timer_exception(std::strerror(errno));
+                }
+                struct itimerspec timerspec;
+                std::memset(&timerspec, 0, sizeof(timerspec));
+                timerspec.it_value.tv_sec = duration.count() / 1000000000;
+                timerspec.it_value.tv_nsec = duration.count() % 1000000000;
+                if(-1 == timerfd_settime(timerfd, 0, &timerspec, nullptr)) {
+                    throw timer_exception(std::strerror(errno));
+                }
+                loop.watch(timerfd, EPOLLIN, &detail::resume_address, h.address());
+                armed = true;
+            }
+            void await_resume() noexcept {
+                armed = false;
+            }
+        private:
+            event_loop& loop;
+            std::chrono::nanoseconds duration;
+            int timerfd;
+            bool armed;
+        };
+
+        inline sleep_awaiter sleep_for(event_loop& loop, std::chrono::nanoseconds duration) {
+            return sleep_awaiter(loop, duration);
+        }
+
+        class resume_on_awaiter {
+        public:
+            resume_on_awaiter(event_loop& lp, priority p): loop(lp), prio(p) {
+            }
+            bool await_ready() const noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> h) {
+                loop.async_call([h]() { h.resume(); }, prio);
+            }
+            void await_resume() const noexcept {
+            }
+        private:
+            event_loop& loop;
+            priority prio;
+        };
+
+        // hop to loop, the coroutine continues on loop's thread
+        inline resume_on_awaiter resume_on(event_loop& loop, priority prio = priority::normal) {
+            return resume_on_awaiter(loop, prio);
+        }
+    }
+}
+#endif
@@ -10,15 +10,18 @@
 #include <cstdio>
 #endif
 
-#include <functional>
+#include "callable.hxx"
+
 #include <queue>
 #include <exception>
+#include <stdexcept>
 #include <memory>
 #include <string>
 #include <map>
 #include <thread>
 #include <vector>
 #include <utility>
+#include <chrono>
 
 namespace linux {
     namespace event {
@@ -27,6 +30,35 @@ namespace linux {
             void operator()(int* pfd);
         };
 
+        // every handoff of a callback is a move, never allocates
+        typedef callable<void()> callback_t;
+
+        // FIFO of callbacks recycling its slots, it only allocates when it
+        // grows past its high water mark, never on push or pop after that
+        class callback_ring {
+        public:
+            explicit callback_ring(std::size_t capacity = 256);
+            callback_ring(const callback_ring& r) = delete;
+            callback_ring& operator=(const callback_ring& r) = delete;
+            bool empty() const {
+                return count == 0;
+            }
+            void push(callback_t&& cb);
+            callback_t& front() {
+                return slots[head];
+            }
+            void pop();
+            // exchanges the slot arrays, no allocation
+            void swap(callback_ring& r);
+        private:
+            void grow();
+            std::unique_ptr<callback_t[]> slots;
+            // always a power of 2
+            std::size_t capacity;
+            std::size_t head;
+            std::size_t count;
+        };
+
         class timer_exception: public std::runtime_error {
         public:
             timer_exception(const std::string& msg): runtime_error(msg) {
@@ -39,14 +71,18 @@ namespace linux {
             }
             trigger(const trigger& tgr) = delete;
             trigger& operator=(const trigger& tgr) = delete;
-            virtual const std::function<void()>& get_task() const = 0;
+            virtual const callback_t& get_task() const = 0;
+            // called by event_loop once native handle is ready
+            virtual void fire() const {
+                get_task()();
+            }
             virtual ~trigger() {
             }
         };
 
         class timer_trigger: public trigger {
         public:
-            timer_trigger(uint64_t sec, std::function<void()>&& tsk);
+            timer_trigger(uint64_t sec, callback_t&& tsk);
             timer_trigger(timer_trigger&& tgr);
             timer_trigger& operator=(timer_trigger&& tgr);
             timer_trigger(const timer_trigger& tgr) = delete;
@@ -54,12 +90,13 @@ namespace linux {
             int native_handle() const {
                 return timerfd;
             }
-            const std::function<void()>& get_task() const override {
-                return std::ref(task);
+            const callback_t& get_task() const override {
+                return task;
             }
             uint32_t get_events() const {
                 return events;
             }
+            void fire() const override;
             virtual ~timer_trigger() {
 #ifdef DEBUG
                 std::printf("timer_trigger deconstructor, id = %d, timerfd = %d\n", id, timerfd);
@@ -68,7 +105,7 @@ namespace linux {
         private:
             int timerfd;
             std::unique_ptr<int, deleter4fd> timerfd_raii;
-            std::function<void()> task;
+            callback_t task;
             std::uint32_t events;
 #ifdef DEBUG
             static std::uint32_t count;
@@ -86,11 +123,11 @@ namespace linux {
         public:
             thread();
             void register_trigger(const trigger& t);
-            void async_call(const std::function<void()>& callee);
+            void async_call(callback_t&& callee);
         private:
             static void* thread_start(void* arg);
             void run();
-            std::queue<std::function<void()>> async_queue;
+            std::queue<callback_t> async_queue;
             pthread_mutex_t async_queue_guard;
             pthread_t thread_handle;
             int epollfd;
@@ -104,12 +141,19 @@ namespace linux {
             struct epoll_event events[MAX_EVENTS];
             struct event_helper {
                 struct epoll_event event;
-                std::function<void()> task;
+                callback_t task;
             };
             typedef std::map<int, event_helper> hcontainer_t;
             hcontainer_t event_helpers;
         };
 
+        // async tasks are drained lane by lane, urgent first
+        enum class priority {
+            urgent,
+            normal,
+            background
+        };
+
         class event_loop_exception: public std::runtime_error {
         public:
             event_loop_exception(const std::string& msg): runtime_error(msg) {
@@ -129,16 +173,35 @@ namespace linux {
                 struct epoll_event ev;
                 ev.data.fd = tgr.native_handle();
                 ev.events = tgr.get_events();
-                auto task = std::bind(&event_loop::do_register, this, ev);
+                auto task = [this, ev]() { do_register(ev); };
 
                 std::unique_ptr<T> trigger(new T(std::move(tgr)));
                 auto fd = ev.data.fd;
                 triggers.insert(make_pair(std::move(fd), std::move(trigger)));
                 async_call(std::move(task));
             }
-            void async_call(std::function<void()>&& task);
+            // thread safe, could be called from any thread
+            void async_call(callback_t&& task, priority prio = priority::normal);
+            // at most max_tasks async tasks or max_time per iteration, the rest
+            // is deferred to next iteration after I/O events have been handled
+            void set_budget(std::uint32_t max_tasks, std::chrono::microseconds max_time);
+            // one-shot readiness notification, resume(arg) is called from the loop
+            // once fd becomes ready for events (EPOLLIN or EPOLLOUT), an error or
+            // hang up wakes both directions. MUST be called from the loop thread
+            void watch(int fd, std::uint32_t events, void (*resume)(void*), void* arg);
+            // drop a pending watch for events, e.g. its waiter has been destroyed
+            void unwatch(int fd, std::uint32_t events);
         private:
             void do_register(struct epoll_event ev);
+            void arm_watch(int fd);
+            void dispatch_watch(const struct epoll_event& ev);
+            // fd in the lower half so data.fd still reads it, x86_64 is little endian
+            static std::uint64_t watch_data(int fd, std::uint32_t generation) {
+                return static_cast<std::uint64_t>(generation) << 32 | static_cast<std::uint32_t>(fd);
+            }
+            void collect_async_tasks();
+            void run_async_tasks();
+            bool has_pending_tasks() const;
             int epollfd;
             std::unique_ptr<int, deleter4fd> epollfd_raii;
             int async_eventfd;
@@ -150,7 +213,28 @@ namespace linux {
             struct epoll_event events[MAX_EVENTS];
             typedef std::map<int, std::unique_ptr<trigger>> trigger_container_t;
             trigger_container_t triggers;
-            std::queue<std::function<void()>> async_queue;
+            struct io_watch {
+                void (*on_readable)(void*);
+                void* readable_arg;
+                void (*on_writable)(void*);
+                void* writable_arg;
+                bool registered;
+                // in the upper half of epoll_event.data, events of an earlier
+                // watch on a reused fd number are dropped
+                std::uint32_t generation;
+            };
+            typedef std::map<int, io_watch> watch_container_t;
+            watch_container_t watches;
+            std::uint32_t watch_generation;
+            constexpr static std::size_t PRIORITY_LEVELS = 3;
+            typedef callback_ring task_queue_t;
+            // filled by async_call, guarded by async_queue_guard
+            task_queue_t async_queues[PRIORITY_LEVELS];
+            pthread_mutex_t async_queue_guard;
+            // only touched by the loop thread, carry deferred tasks over iterations
+            task_queue_t ready_queues[PRIORITY_LEVELS];
+            std::uint32_t task_budget;
+            std::chrono::microseconds time_budget;
         };
     }
 }
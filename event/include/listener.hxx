@@ -0,0 +1,92 @@
+#ifndef LINUX_EVENT_LISTENER_HXX
+#define LINUX_EVENT_LISTENER_HXX
+
+#include "event.hxx"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <cstdint>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace linux {
+    namespace event {
+
+        class listener_exception: public std::runtime_error {
+        public:
+            listener_exception(const std::string& msg): runtime_error(msg) {
+            }
+        };
+
+        struct listener_options {
+            listener_options(): backlog(SOMAXCONN), reuse_port(false), steer_by_cpu(false),
+                                steering_prog_fd(-1), exclusive(false) {
+            }
+            // capped by /proc/sys/net/core/somaxconn
+            int backlog;
+            // SO_REUSEPORT, create one listener per event_loop on the same address
+            bool reuse_port;
+            // with reuse_port, a classic BPF program picks the listener by the cpu
+            // receiving the connection. Listeners MUST be created in cpu order,
+            // one per cpu, the kernel falls back to hashing otherwise
+            bool steer_by_cpu;
+            // with reuse_port, an eBPF program attached by SO_ATTACH_REUSEPORT_EBPF
+            int steering_prog_fd;
+            // EPOLLEXCLUSIVE, only one of the loops sharing the listening socket
+            // wakes up per connection, see listener::share
+            bool exclusive;
+        };
+
+        /****************************************************************
+         ** non-blocking TCP listening socket, every readiness event
+         ** drains the accept queue with accept4, accepted sockets are
+         ** already non-blocking and close-on-exec
+         ***************************************************************/
+        class listener: public trigger {
+        public:
+            // handler owns the accepted socket
+            typedef callable<void(int)> accept_handler_t;
+            listener(const struct sockaddr_in& addr, accept_handler_t&& handler,
+                     const listener_options& options = listener_options());
+            listener(listener&& l);
+            listener& operator=(listener&& l);
+            listener(const listener& l) = delete;
+            listener& operator=(const listener& l) = delete;
+            // another handle on the same listening socket for another event_loop,
+            // only for listeners created with options.exclusive so that every
+            // handle is registered with EPOLLEXCLUSIVE, throws otherwise
+            listener share(accept_handler_t&& handler) const;
+            int native_handle() const {
+                return state->sockfd;
+            }
+            const callback_t& get_task() const override {
+                return task;
+            }
+            uint32_t get_events() const {
+                return events;
+            }
+        private:
+            // on the heap, task refers to it and must survive moves into event_loop
+            struct listener_state {
+                int sockfd;
+                std::unique_ptr<int, deleter4fd> sockfd_raii;
+                // reserved descriptor, released to accept and drop connections
+                // when the process runs out of descriptors
+                int spare_fd;
+                std::unique_ptr<int, deleter4fd> spare_fd_raii;
+                accept_handler_t handler;
+            };
+            static void init_state(listener_state* s, int fd, accept_handler_t&& handler);
+            static bool shed(listener_state* s);
+            listener(int fd, accept_handler_t&& handler, std::uint32_t ev);
+            static void drain(listener_state* s);
+            std::unique_ptr<listener_state> state;
+            callback_t task;
+            std::uint32_t events;
+        };
+    }
+}
+#endif
@@ -0,0 +1,158 @@
+#include "listener.hxx"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef DEBUG
+#include <cstdio>
+#endif
+
+using namespace std;
+
+namespace linux {
+    namespace event {
+
+        listener::listener(const struct sockaddr_in& addr, accept_handler_t&& handler,
+                           const listener_options& options):
+            state(new listener_state()), events(EPOLLIN) {
+            init_state(state.get(), -1, move(handler));
+            auto& sockfd = state->sockfd;
+            if((sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+                throw listener_exception(strerror(errno));
+            }
+#ifdef DEBUG
+            printf("listener::sockfd = %d\n", sockfd);
+#endif
+            int enable = 1;
+            if(-1 == setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable))) {
+                throw listener_exception(strerror(errno));
+            }
+            if(options.reuse_port) {
+                if(-1 == setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable))) {
+                    throw listener_exception(strerror(errno));
+                }
+            }
+            if(-1 == bind(sockfd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr))) {
+                throw listener_exception(strerror(errno));
+            }
+            if(options.reuse_port && options.steer_by_cpu) {
+                // return the cpu id as the index in the reuseport group
+                struct sock_filter code[] = {
+                    { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+                    { BPF_RET | BPF_A, 0, 0, 0 },
+                };
+                struct sock_fprog prog;
+                prog.len = sizeof(code)/sizeof(code[0]);
+                prog.filter = code;
+                if(-1 == setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+                    throw listener_exception(strerror(errno));
+                }
+            }
+            if(options.reuse_port && options.steering_prog_fd >= 0) {
+                if(-1 == setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF,
+                                    &options.steering_prog_fd, sizeof(options.steering_prog_fd))) {
+                    throw listener_exception(strerror(errno));
+                }
+            }
+            if(-1 == listen(sockfd, options.backlog)) {
+                throw listener_exception(strerror(errno));
+            }
+            if(options.exclusive) {
+                events |= EPOLLEXCLUSIVE;
+            }
+            auto s = state.get();
+            task = [s]() { drain(s); };
+        }
+
+        listener::listener(int fd, accept_handler_t&& handler, uint32_t ev):
+            state(new listener_state()), events(ev) {
+            init_state(state.get(), fd, move(handler));
+            auto s = state.get();
+            task = [s]() { drain(s); };
+        }
+
+        listener::listener(listener&& l): state(move(l.state)), task(move(l.task)), events(l.events) {
+            l.events = 0;
+        }
+
+        listener& listener::operator=(listener&& l) {
+            state = move(l.state);
+            task = move(l.task);
+            events = l.events;
+            l.events = 0;
+            return *this;
+        }
+
+        void listener::init_state(listener_state* s, int fd, accept_handler_t&& handler) {
+            s->sockfd = fd;
+            s->sockfd_raii.reset(&s->sockfd);
+            s->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            s->spare_fd_raii.reset(&s->spare_fd);
+            s->handler = move(handler);
+        }
+
+        listener listener::share(accept_handler_t&& handler) const {
+            // without it the original handle's loop still wakes up for every connection
+            if((events & EPOLLEXCLUSIVE) == 0) {
+                throw listener_exception("share requires listener_options::exclusive");
+            }
+            // same open file description, so EPOLLEXCLUSIVE applies across loops
+            auto fd = fcntl(state->sockfd, F_DUPFD_CLOEXEC, 0);
+            if(-1 == fd) {
+                throw listener_exception(strerror(errno));
+            }
+            return listener(fd, move(handler), events);
+        }
+
+        bool listener::shed(listener_state* s) {
+            deleter4fd()(&s->spare_fd);
+            auto fd = accept4(s->sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+            auto dropped = fd != -1;
+            deleter4fd()(&fd);
+#ifdef DEBUG
+            if(dropped) {
+                printf("listener out of file descriptors, connection dropped\n");
+            }
+#endif
+            // -1 if another thread took the slot, the next EMFILE then returns
+            s->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            return dropped;
+        }
+
+        void listener::drain(listener_state* s) {
+            // level triggered, whatever is left is reported again by next epoll_wait
+            while(true) {
+                auto fd = accept4(s->sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(-1 == fd) {
+                    // the peer gave up before being accepted, keep going
+                    if(EINTR == errno || ECONNABORTED == errno) {
+                        continue;
+                    }
+                    // level triggered, returning on fd exhaustion would spin on
+                    // epoll_wait, drop the connections instead. accept4 reports
+                    // EMFILE even on an empty queue, stop once nothing is dropped
+                    if((EMFILE == errno || ENFILE == errno) && s->spare_fd >= 0) {
+                        if(shed(s)) {
+                            continue;
+                        }
+                        return;
+                    }
+                    // EAGAIN means drained
+#ifdef DEBUG
+                    if(EAGAIN != errno) {
+                        printf("listener::accept4 failed, %s\n", strerror(errno));
+                    }
+#endif
+                    return;
+                }
+                s->handler(fd);
+            }
+        }
+    }
+}
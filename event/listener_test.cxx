@@ -0,0 +1,181 @@
+// ../run listener event.cxx
+#include "listener.hxx"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace linux::event;
+
+// counts how often event_loop hands the listening socket over
+class counting_listener: public listener {
+public:
+    counting_listener(const struct sockaddr_in& addr, accept_handler_t&& handler, int* counter,
+                      const listener_options& options = listener_options()):
+        listener(addr, move(handler), options), fires(counter) {
+    }
+    counting_listener(counting_listener&& l): listener(move(l)), fires(l.fires) {
+    }
+    void fire() const override {
+        ++*fires;
+        listener::fire();
+    }
+private:
+    int* fires;
+};
+
+struct sockaddr_in loopback() {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // ephemeral, see bound_address
+    addr.sin_port = 0;
+    return addr;
+}
+
+struct sockaddr_in bound_address(int sockfd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    assert(0 == getsockname(sockfd, reinterpret_cast<struct sockaddr*>(&addr), &len));
+    return addr;
+}
+
+// blocking connect, returns once the connection is in the accept queue
+int connect_to(const struct sockaddr_in& addr) {
+    auto fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    assert(fd >= 0);
+    assert(0 == connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)));
+    return fd;
+}
+
+void stop() {
+    kill(getpid(), SIGUSR1);
+}
+
+// event_loop leaves SIGUSR1 pending so every loop stops, take it before
+// the next loop of the test runs
+void consume_stop() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    struct timespec none = {0, 0};
+    assert(sigtimedwait(&mask, nullptr, &none) == SIGUSR1);
+}
+
+void test_drain() {
+    constexpr int CLIENTS = 16;
+    event_loop ep;
+    auto fires = 0;
+    vector<int> accepted;
+    counting_listener lsn(loopback(), [&accepted](int fd) {
+            accepted.push_back(fd);
+            if(accepted.size() == CLIENTS) {
+                stop();
+            }
+        }, &fires);
+    auto addr = bound_address(lsn.native_handle());
+    vector<int> clients;
+    for(auto i = 0; i < CLIENTS; ++i) {
+        clients.push_back(connect_to(addr));
+    }
+    ep.register_trigger(move(lsn));
+    ep();
+    consume_stop();
+    // all pending connections on one readiness event
+    assert(fires == 1);
+    assert(accepted.size() == CLIENTS);
+    for(auto fd: accepted) {
+        assert((fcntl(fd, F_GETFL) & O_NONBLOCK) != 0);
+        assert((fcntl(fd, F_GETFD) & FD_CLOEXEC) != 0);
+        close(fd);
+    }
+    for(auto fd: clients) {
+        close(fd);
+    }
+    printf("drain passed, %d connections in one fire\n", CLIENTS);
+}
+
+void test_share() {
+    listener plain(loopback(), [](int fd) { close(fd); });
+    auto thrown = false;
+    try {
+        plain.share([](int fd) { close(fd); });
+    } catch(const listener_exception& e) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    listener_options options;
+    options.exclusive = true;
+    vector<int> accepted;
+    listener exclusive(loopback(), [&accepted](int fd) { accepted.push_back(fd); }, options);
+    auto shared = exclusive.share([&accepted](int fd) { accepted.push_back(fd); });
+    assert((exclusive.get_events() & EPOLLEXCLUSIVE) != 0);
+    assert((shared.get_events() & EPOLLEXCLUSIVE) != 0);
+    assert(shared.native_handle() != exclusive.native_handle());
+    // same listening socket behind both handles
+    auto client = connect_to(bound_address(exclusive.native_handle()));
+    shared.fire();
+    assert(accepted.size() == 1);
+    close(accepted.front());
+    close(client);
+    printf("share passed\n");
+}
+
+void test_out_of_descriptors() {
+    event_loop ep;
+    auto fires = 0;
+    auto accepted = 0;
+    counting_listener lsn(loopback(), [&accepted](int fd) {
+            ++accepted;
+            close(fd);
+        }, &fires);
+    auto client = connect_to(bound_address(lsn.native_handle()));
+    ep.register_trigger(move(lsn));
+    // lowest free descriptor, no descriptor can be opened below the limit
+    auto lowest = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    assert(lowest >= 0);
+    close(lowest);
+    struct rlimit original;
+    assert(0 == getrlimit(RLIMIT_NOFILE, &original));
+    struct rlimit exhausted = original;
+    exhausted.rlim_cur = lowest;
+    assert(0 == setrlimit(RLIMIT_NOFILE, &exhausted));
+    assert(-1 == open("/dev/null", O_RDONLY | O_CLOEXEC) && EMFILE == errno);
+    std::thread stopper([]() {
+            this_thread::sleep_for(chrono::milliseconds(100));
+            stop();
+        });
+    ep();
+    stopper.join();
+    consume_stop();
+    assert(0 == setrlimit(RLIMIT_NOFILE, &original));
+    // dropped rather than accepted, and no busy loop on the listening socket
+    assert(accepted == 0);
+    assert(fires <= 2);
+    char c;
+    assert(read(client, &c, 1) <= 0);
+    close(client);
+    printf("out of descriptors passed, %d fires in 100 ms\n", fires);
+}
+
+int main(int argc, char *argv[]) {
+    test_drain();
+    test_share();
+    test_out_of_descriptors();
+    return 0;
+}
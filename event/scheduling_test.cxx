@@ -0,0 +1,168 @@
+// ../run scheduling event.cxx
+#include "event.hxx"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cassert>
+#include <cstdio>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace linux::event;
+
+// a socket with unread data, level triggered so every epoll_wait reports it
+class ready_socket: public trigger {
+public:
+    ready_socket(callback_t&& tsk): task(move(tsk)) {
+        assert(0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+        assert(write(sv[0], "x", 1) == 1);
+    }
+    ready_socket(ready_socket&& s): task(move(s.task)) {
+        sv[0] = s.sv[0];
+        sv[1] = s.sv[1];
+        s.sv[0] = -1;
+        s.sv[1] = -1;
+    }
+    ~ready_socket() {
+        deleter4fd()(&sv[0]);
+        deleter4fd()(&sv[1]);
+    }
+    int native_handle() const {
+        return sv[1];
+    }
+    const callback_t& get_task() const override {
+        return task;
+    }
+    uint32_t get_events() const {
+        return EPOLLIN;
+    }
+private:
+    int sv[2];
+    callback_t task;
+};
+
+void stop() {
+    kill(getpid(), SIGUSR1);
+}
+
+// event_loop leaves SIGUSR1 pending so every loop stops, take it before
+// the next loop of the test runs
+void consume_stop() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    struct timespec none = {0, 0};
+    assert(sigtimedwait(&mask, nullptr, &none) == SIGUSR1);
+}
+
+void test_priority() {
+    event_loop ep;
+    string order;
+    // queued before the loop runs, all collected in the same iteration
+    ep.async_call([&order]() { order += "b1 "; }, priority::background);
+    ep.async_call([&order]() { order += "n1 "; });
+    ep.async_call([&order]() { order += "u1 "; }, priority::urgent);
+    ep.async_call([&order]() { order += "n2 "; }, priority::normal);
+    ep.async_call([&order]() { order += "u2 "; }, priority::urgent);
+    ep.async_call([]() { stop(); }, priority::background);
+    ep();
+    consume_stop();
+    assert(order == "u1 u2 n1 n2 b1 ");
+    printf("priority lanes passed\n");
+}
+
+// polls seen by every flood task, the socket is polled once per iteration
+map<int, int> slices_of(const vector<int>& seen) {
+    map<int, int> slices;
+    for(size_t i = 0; i < seen.size(); ++i) {
+        if(i > 0) {
+            // one iteration at most between two consecutive tasks
+            assert(seen[i] == seen[i - 1] || seen[i] == seen[i - 1] + 1);
+        }
+        ++slices[seen[i]];
+    }
+    return slices;
+}
+
+void test_task_budget() {
+    constexpr int BUDGET = 4;
+    constexpr int TASKS = 40;
+    event_loop ep;
+    ep.set_budget(BUDGET, chrono::microseconds(1000000));
+    auto polls = 0;
+    ep.register_trigger(ready_socket([&polls]() { ++polls; }));
+    vector<int> seen;
+    auto urgent_after = -1;
+    // posted from the loop after the socket has been registered
+    ep.async_call([&]() {
+            for(auto i = 0; i < TASKS; ++i) {
+                ep.async_call([&, i]() {
+                        seen.push_back(polls);
+                        if(i == 0) {
+                            // deferred normal tasks MUST NOT delay a later urgent one
+                            ep.async_call([&]() { urgent_after = seen.size(); }, priority::urgent);
+                        }
+                        if(i == TASKS - 1) {
+                            stop();
+                        }
+                    });
+            }
+        }, priority::background);
+    ep();
+    consume_stop();
+    assert(seen.size() == TASKS);
+    auto slices = slices_of(seen);
+    for(auto& slice: slices) {
+        assert(slice.second <= BUDGET);
+    }
+    // the rest is carried over, not dropped and not run in one go
+    assert(slices.size() >= TASKS / BUDGET);
+    // first in the slice following the one that posted it
+    assert(urgent_after == BUDGET);
+    printf("task budget passed, %d tasks in %zu iterations\n", TASKS, slices.size());
+}
+
+void test_time_budget() {
+    constexpr int TASKS = 10;
+    event_loop ep;
+    ep.set_budget(1000, chrono::microseconds(2000));
+    auto polls = 0;
+    ep.register_trigger(ready_socket([&polls]() { ++polls; }));
+    vector<int> seen;
+    ep.async_call([&]() {
+            for(auto i = 0; i < TASKS; ++i) {
+                ep.async_call([&, i]() {
+                        seen.push_back(polls);
+                        this_thread::sleep_for(chrono::milliseconds(1));
+                        if(i == TASKS - 1) {
+                            stop();
+                        }
+                    });
+            }
+        }, priority::background);
+    ep();
+    consume_stop();
+    assert(seen.size() == TASKS);
+    // the deadline passes after the second task of every slice
+    auto slices = slices_of(seen);
+    for(auto& slice: slices) {
+        assert(slice.second <= 2);
+    }
+    printf("time budget passed, %d tasks in %zu iterations\n", TASKS, slices.size());
+}
+
+int main(int argc, char *argv[]) {
+    test_priority();
+    test_task_budget();
+    test_time_budget();
+    return 0;
+}
@@ -34,27 +34,68 @@ struct deleter {
     }
 };
 
+// one line per request, a read may hold part of a line or many lines
 class client {
 public:
-    client(int fd): socketfd(fd), size(0), raii_socketfd(&socketfd) {
+    client(int fd): socketfd(fd), used(0), scanned(0), written(0), raii_socketfd(&socketfd) {
     }
 
-    void set_data(void* src, int sz) {
-        memcpy(buf, src, 10);
-        size = 10;
+    // result of read(), bytes land right after those of an incomplete line
+    ssize_t receive() {
+        if(in.size() - used < READ_SIZE) {
+            in.resize(used + READ_SIZE);
+        }
+        auto num = read(socketfd, in.data() + used, in.size() - used);
+        if(num > 0) {
+            used += num;
+        }
+        return num;
+    }
+    // echo every complete line at once, pipelined requests are written back
+    // with one write. false if a line exceeds MAX_LINE
+    bool process() {
+        size_t begin = 0;
+        while(auto p = static_cast<char*>(memchr(in.data() + scanned, '\n', used - scanned))) {
+            scanned = p - in.data() + 1;
+            out.insert(out.end(), in.data() + begin, in.data() + scanned);
+            begin = scanned;
+        }
+        if(begin > 0) {
+            memmove(in.data(), in.data() + begin, used - begin);
+            used -= begin;
+        }
+        // no line end in what is left, don't search it again
+        scanned = used;
+        return used <= MAX_LINE;
     }
-    void get_data(void* des, int& sz) const {
-        memcpy(des, buf, 10);
-        sz = 10;
+    // false if the socket can't take more now, errno tells why
+    bool flush() {
+        while(written < out.size()) {
+            auto num = write(socketfd, out.data() + written, out.size() - written);
+            if(-1 == num) {
+                if(EINTR == errno) {
+                    continue;
+                }
+                return false;
+            }
+            written += num;
+        }
+        out.clear();
+        written = 0;
+        return true;
     }
     int getsocket() const {
         return socketfd;
     }
 private:
+    constexpr static size_t READ_SIZE = 4096;
+    constexpr static size_t MAX_LINE = 64 * 1024;
     int socketfd;
-    constexpr static int BUF_SIZE = 512;
-    char buf[BUF_SIZE];
-    int size;
+    vector<char> in;
+    size_t used;
+    size_t scanned;
+    vector<char> out;
+    size_t written;
     unique_ptr<int, deleter> raii_socketfd;
 };
 
@@ -91,7 +132,8 @@ int main(int argc, char *argv[]) {
         perror("failed to bind listening socket");
         return EXIT_FAILURE;
     }
-    constexpr int BACKLOG = 10;
+    // capped by /proc/sys/net/core/somaxconn
+    constexpr int BACKLOG = SOMAXCONN;
     if(-1 == listen(listenfd, BACKLOG)) {
         perror("failed to listening socket");
         return EXIT_FAILURE;
@@ -112,43 +154,56 @@ int main(int argc, char *argv[]) {
         auto nfds = epoll_wait(epollfd, events, MAX_EVENTS, -1);
         for(auto i = 0; i < nfds; ++i) {
             if(listenfd == events[i].data.fd) {
-                auto fd = accept(listenfd, nullptr, nullptr);
-                unique_ptr<client> raii_client(new client(fd));
-                auto flags = fcntl(fd, F_GETFL);
-                flags |= O_NONBLOCK;
-                if(-1 == fcntl(fd, F_SETFL, flags)) {
-                    perror("failed to set NONBLOCK on file descriptor");
-                    continue;
+                // drain the accept queue, accepted socket is already non-blocking
+                while(true) {
+                    auto fd = accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if(-1 == fd) {
+                        if(EINTR == errno || ECONNABORTED == errno) {
+                            continue;
+                        }
+                        if(EAGAIN != errno) {
+                            perror("failed to accept connection");
+                        }
+                        break;
+                    }
+                    unique_ptr<client> raii_client(new client(fd));
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN;
+                    ev.data.fd = fd;
+                    if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev)) {
+                        perror("failed to add file descriptor to epoll monitor");
+                    }
+                    pair<int, unique_ptr<client>> p(move(fd), move(raii_client));
+                    clients.insert(move(p));
                 }
-                memset(&ev, 0, sizeof(ev));
-                ev.events = EPOLLIN;
-                ev.data.fd = fd;
-                if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev)) {
-                    perror("failed to add file descriptor to epoll monitor");
-                }
-                pair<int, unique_ptr<client>> p(move(fd), move(raii_client));
-                clients.insert(move(p));
             } else if((EPOLLIN & events[i].events) != 0) {
-                constexpr int BUF_SIZE = 256;
-                char buf[BUF_SIZE];
                 auto fd = events[i].data.fd;
-                auto num = read(fd, buf, sizeof(buf));
-                if(num > 0) {
-                    clients[fd]->set_data(buf, num);
+                auto& c = *clients[fd];
+                auto num = c.receive();
+                if(-1 == num && (EAGAIN == errno || EINTR == errno)) {
+                    // level triggered, reported again if still readable
+                    continue;
+                }
+                if(num <= 0 || !c.process()) {
+                    clients.erase(fd);
+                    continue;
+                }
+                if(!c.flush()) {
+                    if(EAGAIN != errno) {
+                        clients.erase(fd);
+                        continue;
+                    }
                     events[i].events = EPOLLOUT;
                     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &events[i]);
-                } else {
-                    clients.erase(fd);
                 }
             } else if((EPOLLOUT & events[i].events) != 0) {
                 auto fd = events[i].data.fd;
-                constexpr int BUF_SIZE = 256;
-                char buf[BUF_SIZE];
-                int num = BUF_SIZE;
-                clients[fd]->get_data(buf, num);
-                write(fd, buf, num);
-                events[i].events = EPOLLIN;
-                epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &events[i]);
+                if(clients[fd]->flush()) {
+                    events[i].events = EPOLLIN;
+                    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &events[i]);
+                } else if(EAGAIN != errno) {
+                    clients.erase(fd);
+                }
             }
         }
     }
@@ -9,9 +9,27 @@
 #include <cstring>
 
 #include <iostream>
+#include <string>
 
 using namespace std;
 
+constexpr size_t MAX_LINE = 64 * 1024;
+
+bool write_all(int fd, const string& data) {
+    size_t written = 0;
+    while(written < data.size()) {
+        auto num = write(fd, data.data() + written, data.size() - written);
+        if(-1 == num) {
+            if(EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+        written += num;
+    }
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     auto sfd = socket(AF_UNIX, SOCK_STREAM, 0);
     sockaddr_un addr;
@@ -23,12 +41,37 @@ int main(int argc, char *argv[]) {
     bool stop = false;
     while(!stop) {
         auto cfd = accept(sfd, nullptr, nullptr);
-        int num = 0;
-        char buf[256]{};
         char echo[]{"echo: "};
-        while((num = read(cfd, buf, sizeof(buf))) > 0) {
-            write(cfd, echo, sizeof(echo));
-            write(cfd, buf, num);
+        // one line per message, however the bytes are split across reads
+        string pending;
+        while(true) {
+            char buf[256];
+            auto num = read(cfd, buf, sizeof(buf));
+            if(-1 == num && EINTR == errno) {
+                continue;
+            }
+            if(num <= 0) {
+                break;
+            }
+            // only the new bytes may hold the end of the pending line
+            auto pos = pending.size();
+            pending.append(buf, num);
+            string reply;
+            size_t begin = 0;
+            while((pos = pending.find('\n', pos)) != string::npos) {
+                reply += echo;
+                reply.append(pending, begin, ++pos - begin);
+                begin = pos;
+            }
+            pending.erase(0, begin);
+            // all complete lines of this read are echoed with one write
+            if(!write_all(cfd, reply)) {
+                break;
+            }
+            if(pending.size() > MAX_LINE) {
+                cerr << "line exceeds " << MAX_LINE << " bytes" << endl;
+                break;
+            }
         }
         close(cfd);
     }
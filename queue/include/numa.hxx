@@ -0,0 +1,198 @@
+#ifndef LINUX_QUEUE_NUMA_HXX
+#define LINUX_QUEUE_NUMA_HXX
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace linux {
+
+    namespace numa {
+
+        // ONLY support x86_64 platform!
+        constexpr static const std::size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+        // MPOL_PREFERRED of <linux/mempolicy.h>, avoid a dependency on libnuma
+        constexpr static const int PREFERRED_POLICY = 1;
+
+        inline std::size_t page_size() {
+            return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        }
+
+        // node of the cpu the calling thread is running on
+        inline int current_node() {
+            unsigned cpu = 0;
+            unsigned node = 0;
+            if(-1 == syscall(SYS_getcpu, &cpu, &node, nullptr)) {
+                return 0;
+            }
+            return static_cast<int>(node);
+        }
+
+        // -1 if the kernel doesn't expose the topology
+        inline int node_of_cpu(int cpu) {
+            std::string path("/sys/devices/system/cpu/cpu");
+            path += std::to_string(cpu);
+            auto dir = opendir(path.c_str());
+            if(dir == nullptr) {
+                return -1;
+            }
+            auto node = -1;
+            while(auto entry = readdir(dir)) {
+                if(std::strncmp(entry->d_name, "node", 4) == 0) {
+                    node = std::atoi(entry->d_name + 4);
+                    break;
+                }
+            }
+            closedir(dir);
+            return node;
+        }
+
+        // parse the cpulist format of sysfs, e.g. "0-3,8-11"
+        inline std::vector<int> cpus_of_node(int node) {
+            std::vector<int> cpus;
+            std::string path("/sys/devices/system/node/node");
+            path += std::to_string(node);
+            path += "/cpulist";
+            auto file = std::fopen(path.c_str(), "r");
+            if(file == nullptr) {
+                return cpus;
+            }
+            int first = 0;
+            while(std::fscanf(file, "%d", &first) == 1) {
+                auto last = first;
+                auto c = std::fgetc(file);
+                if(c == '-') {
+                    if(std::fscanf(file, "%d", &last) != 1) {
+                        break;
+                    }
+                    c = std::fgetc(file);
+                }
+                for(auto cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+                if(c != ',') {
+                    break;
+                }
+            }
+            std::fclose(file);
+            return cpus;
+        }
+
+        // pin thread to the cpus of node, call it for both the producer and the
+        // consumer of a queue, or for the thread running an event_loop before the
+        // loop is constructed so its state is first touched on that node
+        inline bool bind_thread_to_node(pthread_t thread, int node) {
+            auto cpus = cpus_of_node(node);
+            if(cpus.empty()) {
+                return false;
+            }
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for(auto cpu: cpus) {
+                CPU_SET(cpu, &set);
+            }
+            return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+        }
+
+        /****************************************************************
+         ** anonymous mapping placed on a NUMA node, optionally backed by
+         ** 2 MB huge pages, prefaulted at construction so the first
+         ** accesses on the hot path never take a page fault
+         ***************************************************************/
+        class buffer {
+        public:
+            // node -1 means the node of the constructing thread (first touch)
+            buffer(std::size_t size, int node = -1, bool huge_pages = false):
+                data(nullptr), length(round_up(size, huge_pages ? HUGE_PAGE_BYTES : page_size())),
+                on_node(node < 0), huge(false) {
+                auto p = MAP_FAILED;
+                if(huge_pages) {
+                    // needs reserved pages in /proc/sys/vm/nr_hugepages
+                    p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                    huge = p != MAP_FAILED;
+                }
+                if(p == MAP_FAILED) {
+                    p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if(p == MAP_FAILED) {
+                        throw std::bad_alloc();
+                    }
+                    if(huge_pages) {
+                        // fall back to transparent huge pages, best effort
+                        madvise(p, length, MADV_HUGEPAGE);
+                    }
+                }
+                data = p;
+                if(node >= 0) {
+                    // preferred rather than bind, don't fail when node is full
+                    unsigned long mask[16] = {};
+                    if(static_cast<std::size_t>(node) < sizeof(mask) * 8) {
+                        mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+                        on_node = 0 == syscall(SYS_mbind, data, length, PREFERRED_POLICY, mask, sizeof(mask) * 8, 0);
+                    }
+                }
+                auto bytes = static_cast<volatile char*>(data);
+                auto step = page_size();
+                for(std::size_t i = 0; i < length; i += step) {
+                    bytes[i] = 0;
+                }
+            }
+            buffer(buffer&& b): data(b.data), length(b.length), on_node(b.on_node), huge(b.huge) {
+                b.data = nullptr;
+                b.length = 0;
+            }
+            buffer& operator=(buffer&& b) {
+                std::swap(data, b.data);
+                std::swap(length, b.length);
+                std::swap(on_node, b.on_node);
+                std::swap(huge, b.huge);
+                return *this;
+            }
+            buffer(const buffer& b) = delete;
+            buffer& operator=(const buffer& b) = delete;
+            ~buffer() {
+                if(data != nullptr) {
+                    munmap(data, length);
+                }
+            }
+            void* get() const {
+                return data;
+            }
+            std::size_t size() const {
+                return length;
+            }
+            // false if the memory policy couldn't be set, e.g. no such node or
+            // a kernel without NUMA, pages then land where they are touched first
+            bool placed() const {
+                return on_node;
+            }
+            // false if MAP_HUGETLB failed, transparent huge pages may still apply
+            bool huge_pages() const {
+                return huge;
+            }
+        private:
+            static std::size_t round_up(std::size_t size, std::size_t alignment) {
+                return (size + alignment - 1) & ~(alignment - 1);
+            }
+            void* data;
+            std::size_t length;
+            bool on_node;
+            bool huge;
+        };
+    }
+}
+
+#endif
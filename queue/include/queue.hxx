@@ -9,6 +9,8 @@
 #include <queue>
 #include <exception>
 
+#include "numa.hxx"
+
 #ifdef DEBUG
 #include <cstdio>
 #endif
@@ -24,15 +26,25 @@ namespace linux {
         // load-load
         // load-store
 
+        // the slot arrays below are allocated on the NUMA node of the consumer
+        // and prefaulted, node -1 means the node of the constructing thread.
+        // huge_pages backs the 512 KB of slots with 2 MB pages to save TLB misses.
+        // placed() tells whether the NUMA placement took effect
+        constexpr static const std::size_t cache_line_size = 64;
+
         /****************************************************************
          ** single reader and single writer
          ***************************************************************/
         template<typename T>
         class sr_sw_queue {
         public:
-            sr_sw_queue(): reader_pos(0), writer_pos(0) {
-                std::memset(circular_buffer, 0, sizeof(circular_buffer));
+            explicit sr_sw_queue(int node = -1, bool huge_pages = false):
+                reader_pos(0), writer_pos(0),
+                storage(buffer_size * sizeof(T*), node, huge_pages),
+                circular_buffer(static_cast<T**>(storage.get())) {
             }
+            sr_sw_queue(const sr_sw_queue& q) = delete;
+            sr_sw_queue& operator=(const sr_sw_queue& q) = delete;
             bool add(T* p) {
                 if(count() == buffer_size) {
                     return false;
@@ -44,6 +56,9 @@ namespace linux {
                 ++writer_pos;
                 return true;
             }
+            bool placed() const {
+                return storage.placed();
+            }
             bool remove(T*& p) {
                 if(count() == 0) {
                     return false;
@@ -59,10 +74,16 @@ namespace linux {
             std::uint64_t count() {
                 return writer_pos - reader_pos;
             }
+            // separate cache lines, the reader and the writer don't bounce each
+            // other. Padding rather than alignas, operator new of C++11 ignores
+            // extended alignment
             std::uint64_t reader_pos;
+            char reader_padding[cache_line_size - sizeof(std::uint64_t)];
             std::uint64_t writer_pos;
+            char writer_padding[cache_line_size - sizeof(std::uint64_t)];
             constexpr static const std::uint64_t buffer_size = 65536;
-            T* circular_buffer[buffer_size];
+            numa::buffer storage;
+            T** circular_buffer;
         };
 
         template<typename T>
@@ -113,9 +134,13 @@ namespace linux {
         template<typename T>
         class sr_mw_queue {
         public:
-            sr_mw_queue(): reader_pos(0), writer_pos(0), writer_lock(0) {
-                std::memset(circular_buffer, 0, sizeof(circular_buffer));
+            explicit sr_mw_queue(int node = -1, bool huge_pages = false):
+                reader_pos(0), writer_pos(0), writer_lock(0),
+                storage(buffer_size * sizeof(T*), node, huge_pages),
+                circular_buffer(static_cast<T**>(storage.get())) {
             }
+            sr_mw_queue(const sr_mw_queue& q) = delete;
+            sr_mw_queue& operator=(const sr_mw_queue& q) = delete;
             bool add(T* p) {
                 while(__sync_val_compare_and_swap(&writer_lock, 0, 1) != 0);
                 if(count() == buffer_size) {
@@ -131,6 +156,9 @@ namespace linux {
                 writer_lock = 0;
                 return true;
             }
+            bool placed() const {
+                return storage.placed();
+            }
             bool remove(T*& p) {
                 if(count() == 0) {
                     return false;
@@ -146,11 +174,17 @@ namespace linux {
             std::uint64_t count() {
                 return writer_pos - reader_pos;
             }
+            // separate cache lines, the reader and the writers don't bounce each
+            // other. Padding rather than alignas, operator new of C++11 ignores
+            // extended alignment
             std::uint64_t reader_pos;
+            char reader_padding[cache_line_size - sizeof(std::uint64_t)];
             std::uint64_t writer_pos;
             std::uint64_t writer_lock;
+            char writer_padding[cache_line_size - 2 * sizeof(std::uint64_t)];
             constexpr static const std::uint64_t buffer_size = 65536;
-            T* circular_buffer[buffer_size];
+            numa::buffer storage;
+            T** circular_buffer;
         };
 
         template<typename T>
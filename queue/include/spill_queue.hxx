@@ -0,0 +1,406 @@
+#ifndef LINUX_QUEUE_SPILL_QUEUE_HXX
+#define LINUX_QUEUE_SPILL_QUEUE_HXX
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace linux {
+
+    namespace queue {
+
+        class spill_queue_exception: public std::runtime_error {
+        public:
+            spill_queue_exception(const std::string& msg): runtime_error(msg) {
+            }
+        };
+
+        enum class durability {
+            // page cache only, survives a crash of the process, not of the host
+            none,
+            // msync every sync_interval records, on segment switch and on flush
+            batched,
+            // msync every record before add/commit returns
+            always
+        };
+
+        /****************************************************************
+         ** single reader and single writer persistent queue of byte
+         ** records, stored in memory mapped segment files of a directory.
+         ** The writer builds records in place in the mapping and the reader
+         ** gets pointers into the mapping, no copy on either side.
+         ** Fully consumed segments are deleted, unconsumed records are
+         ** recovered when the queue is opened again. Delivery after a
+         ** crash is at least once, the read position may lag behind
+         **
+         ** segment: | header (64 bytes) | record | record | ... | end |
+         ** record:  | length + 1 | checksum | payload, padded to 8 bytes |
+         ** length is stored last and biased by one, so a zero is always the
+         ** unwritten tail, even after a record of zero bytes
+         ***************************************************************/
+        class spill_queue {
+        public:
+            spill_queue(const std::string& dir, std::size_t segment_size = 64 * 1024 * 1024,
+                        durability level = durability::batched, std::uint32_t sync_interval = 256):
+                directory(dir), segment_size(segment_size), level(level), sync_interval(sync_interval),
+                segments_guard(PTHREAD_MUTEX_INITIALIZER), next_sequence(0),
+                write_segment(nullptr), write_offset(0), reserved(0), synced_offset(0), unsynced(0),
+                read_segment(nullptr), read_offset(0), unsynced_pops(0) {
+                if(segment_size < 2 * RECORDS_BEGIN || segment_size % page_size() != 0) {
+                    throw spill_queue_exception("segment size must be a multiple of page size");
+                }
+                if(-1 == mkdir(directory.c_str(), 0755) && EEXIST != errno) {
+                    throw spill_queue_exception(std::strerror(errno));
+                }
+                recover();
+            }
+            spill_queue(const spill_queue& q) = delete;
+            spill_queue& operator=(const spill_queue& q) = delete;
+            ~spill_queue() {
+                if(level != durability::none) {
+                    sync_records();
+                    sync_read_offset();
+                }
+            }
+
+            // producer side
+
+            // space for a record of size bytes in the mapping, visible to the
+            // reader after commit. Throws if size doesn't fit in one segment
+            void* reserve(std::uint32_t size) {
+                if(size >= MAX_RECORD_SIZE) {
+                    throw spill_queue_exception("record is bigger than a segment");
+                }
+                auto needed = record_size(size);
+                // always keep room for the end of segment marker
+                if(RECORDS_BEGIN + needed + sizeof(record_header) > segment_size) {
+                    throw spill_queue_exception("record is bigger than a segment");
+                }
+                if(write_offset + needed + sizeof(record_header) > segment_size) {
+                    switch_write_segment();
+                }
+                reserved = size;
+                return write_segment->base + write_offset + sizeof(record_header);
+            }
+            void commit() {
+                auto record = reinterpret_cast<record_header*>(write_segment->base + write_offset);
+                auto payload = write_segment->base + write_offset + sizeof(record_header);
+                record->checksum = write_segment->header()->checksummed != 0 ? checksum(payload, reserved) : 0;
+                // payload and checksum MUST be visible before the length
+                __atomic_store_n(&record->length, reserved + 1, __ATOMIC_RELEASE);
+                write_offset += record_size(reserved);
+                reserved = 0;
+                ++unsynced;
+                if(level == durability::always || (level == durability::batched && unsynced >= sync_interval)) {
+                    sync_records();
+                }
+            }
+            void add(const void* data, std::uint32_t size) {
+                std::memcpy(reserve(size), data, size);
+                commit();
+            }
+            // make committed records durable now, whatever the level is
+            void flush() {
+                sync_records();
+            }
+
+            // consumer side
+
+            // pointer into the mapping, valid until pop
+            bool front(const void*& data, std::uint32_t& size) {
+                while(true) {
+                    auto record = reinterpret_cast<record_header*>(read_segment->base + read_offset);
+                    auto length = __atomic_load_n(&record->length, __ATOMIC_ACQUIRE);
+                    if(length == 0) {
+                        return false;
+                    }
+                    if(length == END_OF_SEGMENT) {
+                        switch_read_segment();
+                        continue;
+                    }
+                    data = read_segment->base + read_offset + sizeof(record_header);
+                    size = length - 1;
+                    return true;
+                }
+            }
+            void pop() {
+                auto record = reinterpret_cast<record_header*>(read_segment->base + read_offset);
+                read_offset += record_size(__atomic_load_n(&record->length, __ATOMIC_ACQUIRE) - 1);
+                read_segment->header()->read_offset = read_offset;
+                ++unsynced_pops;
+                if(level == durability::always || (level == durability::batched && unsynced_pops >= sync_interval)) {
+                    sync_read_offset();
+                }
+            }
+        private:
+            struct segment_header {
+                std::uint64_t magic;
+                std::uint64_t read_offset;
+                std::uint32_t checksummed;
+            };
+            struct record_header {
+                std::uint32_t length;
+                std::uint32_t checksum;
+            };
+            struct segment {
+                segment(): sequence(0), fd(-1), base(nullptr), size(0) {
+                }
+                ~segment() {
+                    if(base != nullptr) {
+                        munmap(base, size);
+                    }
+                    if(fd >= 0) {
+                        while(-1 == close(fd) && EINTR == errno) {
+                        }
+                    }
+                }
+                segment_header* header() {
+                    return reinterpret_cast<segment_header*>(base);
+                }
+                std::uint64_t sequence;
+                std::string path;
+                int fd;
+                char* base;
+                std::size_t size;
+            };
+
+            constexpr static const std::uint64_t MAGIC = 0x4c4c495053584e4cULL;
+            // stored lengths are biased by one, END_OF_SEGMENT is out of range
+            constexpr static const std::uint32_t MAX_RECORD_SIZE = 0xfffffffe;
+            // header in its own cache line, the reader updates it
+            constexpr static const std::size_t RECORDS_BEGIN = 64;
+            constexpr static const std::uint32_t END_OF_SEGMENT = 0xffffffff;
+
+            static std::size_t page_size() {
+                return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            }
+            static std::size_t record_size(std::uint32_t size) {
+                return sizeof(record_header) + ((static_cast<std::size_t>(size) + 7) & ~static_cast<std::size_t>(7));
+            }
+            // FNV-1a, only to detect records torn by a host crash
+            static std::uint32_t checksum(const char* p, std::uint32_t size) {
+                std::uint32_t hash = 2166136261u;
+                for(std::uint32_t i = 0; i < size; ++i) {
+                    hash ^= static_cast<unsigned char>(p[i]);
+                    hash *= 16777619u;
+                }
+                // zero is reserved for unchecked records
+                return hash == 0 ? 1 : hash;
+            }
+            static std::size_t first_unread(segment& s) {
+                auto offset = s.header()->read_offset;
+                return offset < RECORDS_BEGIN ? RECORDS_BEGIN : offset;
+            }
+            std::string segment_path(std::uint64_t sequence) const {
+                char name[32];
+                std::snprintf(name, sizeof(name), "/%020llu.seg", static_cast<unsigned long long>(sequence));
+                return directory + name;
+            }
+            void map(segment& s) {
+                auto p = mmap(nullptr, s.size, PROT_READ | PROT_WRITE, MAP_SHARED, s.fd, 0);
+                if(p == MAP_FAILED) {
+                    throw spill_queue_exception(std::strerror(errno));
+                }
+                s.base = static_cast<char*>(p);
+            }
+            void sync_directory() {
+                auto fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(fd >= 0) {
+                    fsync(fd);
+                    close(fd);
+                }
+            }
+            segment* create_segment() {
+                std::unique_ptr<segment> s(new segment());
+                s->sequence = next_sequence++;
+                s->path = segment_path(s->sequence);
+                s->size = segment_size;
+                if((s->fd = open(s->path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1) {
+                    throw spill_queue_exception(std::strerror(errno));
+                }
+                // allocate blocks now, a full disk MUST NOT become a SIGBUS later
+                auto ret = posix_fallocate(s->fd, 0, segment_size);
+                if(ret != 0) {
+                    unlink(s->path.c_str());
+                    throw spill_queue_exception(std::strerror(ret));
+                }
+                map(*s);
+                auto header = s->header();
+                header->read_offset = RECORDS_BEGIN;
+                header->checksummed = level != durability::none ? 1 : 0;
+                header->magic = MAGIC;
+                if(level != durability::none) {
+                    msync(s->base, page_size(), MS_SYNC);
+                    sync_directory();
+                }
+                auto result = s.get();
+                // the writer only touches an ended segment until it returns from
+                // switch_write_segment, retired ones are all past that point now
+                std::vector<std::unique_ptr<segment>> released;
+                pthread_mutex_lock(&segments_guard);
+                segments.push_back(std::move(s));
+                released.swap(retired);
+                pthread_mutex_unlock(&segments_guard);
+                return result;
+            }
+            void switch_write_segment() {
+                auto old = write_segment;
+                auto old_offset = write_offset;
+                sync_records();
+                // the reader MUST find the next segment once it sees the end marker
+                write_segment = create_segment();
+                write_offset = RECORDS_BEGIN;
+                synced_offset = RECORDS_BEGIN;
+                auto end = reinterpret_cast<record_header*>(old->base + old_offset);
+                __atomic_store_n(&end->length, END_OF_SEGMENT, __ATOMIC_RELEASE);
+                if(level != durability::none) {
+                    msync(old->base + (old_offset & ~(page_size() - 1)), page_size(), MS_SYNC);
+                }
+            }
+            void switch_read_segment() {
+                pthread_mutex_lock(&segments_guard);
+                // the writer may still be syncing the end marker the reader has
+                // just seen, unmap it once the writer creates the next segment
+                unlink(segments.front()->path.c_str());
+                retired.push_back(std::move(segments.front()));
+                segments.pop_front();
+                read_segment = segments.front().get();
+                pthread_mutex_unlock(&segments_guard);
+                read_offset = RECORDS_BEGIN;
+                unsynced_pops = 0;
+            }
+            void sync_records() {
+                if(write_segment == nullptr || synced_offset == write_offset) {
+                    return;
+                }
+                auto begin = synced_offset & ~(page_size() - 1);
+                msync(write_segment->base + begin, write_offset - begin, MS_SYNC);
+                synced_offset = write_offset;
+                unsynced = 0;
+            }
+            void sync_read_offset() {
+                if(read_segment == nullptr || unsynced_pops == 0) {
+                    return;
+                }
+                msync(read_segment->base, page_size(), MS_SYNC);
+                unsynced_pops = 0;
+            }
+            // offset after the last valid record starting from offset
+            std::size_t scan(segment& s, std::size_t offset) {
+                auto checked = s.header()->checksummed != 0;
+                while(offset + sizeof(record_header) <= s.size) {
+                    auto record = reinterpret_cast<record_header*>(s.base + offset);
+                    if(record->length == 0 || record->length == END_OF_SEGMENT) {
+                        break;
+                    }
+                    auto length = record->length - 1;
+                    if(offset + record_size(length) > s.size) {
+                        break;
+                    }
+                    if(checked && record->checksum != checksum(s.base + offset + sizeof(record_header), length)) {
+                        break;
+                    }
+                    offset += record_size(length);
+                }
+                return offset;
+            }
+            void recover() {
+                std::vector<std::uint64_t> sequences;
+                auto dir = opendir(directory.c_str());
+                if(dir == nullptr) {
+                    throw spill_queue_exception(std::strerror(errno));
+                }
+                while(auto entry = readdir(dir)) {
+                    unsigned long long sequence = 0;
+                    char suffix[8] = {};
+                    if(std::sscanf(entry->d_name, "%20llu.%4s", &sequence, suffix) == 2 && std::strcmp(suffix, "seg") == 0) {
+                        sequences.push_back(sequence);
+                    }
+                }
+                closedir(dir);
+                std::sort(sequences.begin(), sequences.end());
+                for(auto sequence: sequences) {
+                    std::unique_ptr<segment> s(new segment());
+                    s->sequence = sequence;
+                    s->path = segment_path(sequence);
+                    struct stat st;
+                    if((s->fd = open(s->path.c_str(), O_RDWR | O_CLOEXEC)) == -1 || -1 == fstat(s->fd, &st)) {
+                        throw spill_queue_exception(std::strerror(errno));
+                    }
+                    s->size = st.st_size;
+                    if(s->size < page_size()) {
+                        // creation didn't complete
+                        unlink(s->path.c_str());
+                        continue;
+                    }
+                    map(*s);
+                    if(s->header()->magic != MAGIC) {
+                        unlink(s->path.c_str());
+                        continue;
+                    }
+                    next_sequence = sequence + 1;
+                    segments.push_back(std::move(s));
+                }
+                // never append after a recovered tail, it may hold torn bytes. End
+                // every segment after its last valid record, including one the
+                // writer left before its end marker was written, and start anew
+                for(std::size_t i = 0; i < segments.size(); ++i) {
+                    auto& s = *segments[i];
+                    auto begin = i == 0 ? first_unread(s) : RECORDS_BEGIN;
+                    auto end = scan(s, begin);
+                    auto record = reinterpret_cast<record_header*>(s.base + end);
+                    if(record->length != END_OF_SEGMENT) {
+                        record->length = END_OF_SEGMENT;
+                        msync(s.base + (end & ~(page_size() - 1)), page_size(), MS_SYNC);
+                    }
+                }
+                write_segment = create_segment();
+                write_offset = RECORDS_BEGIN;
+                synced_offset = RECORDS_BEGIN;
+                read_segment = segments.front().get();
+                read_offset = first_unread(*read_segment);
+            }
+
+            std::string directory;
+            std::size_t segment_size;
+            durability level;
+            std::uint32_t sync_interval;
+            // the writer appends segments, the reader removes them
+            pthread_mutex_t segments_guard;
+            std::deque<std::unique_ptr<segment>> segments;
+            // consumed and unlinked, still mapped
+            std::vector<std::unique_ptr<segment>> retired;
+            std::uint64_t next_sequence;
+            // writer only
+            segment* write_segment;
+            std::size_t write_offset;
+            std::uint32_t reserved;
+            std::size_t synced_offset;
+            std::uint32_t unsynced;
+            // reader only, on its own cache line. Padding rather than alignas,
+            // operator new of C++11 ignores extended alignment
+            char writer_padding[64];
+            segment* read_segment;
+            std::size_t read_offset;
+            std::uint32_t unsynced_pops;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,68 @@
+// ../run numa
+// headers defining PAGE_SIZE and MPOL_PREFERRED MUST keep working first
+#include <sys/user.h>
+#include <linux/mempolicy.h>
+
+#include "numa.hxx"
+#include "queue.hxx"
+
+#include <pthread.h>
+
+#include <cassert>
+#include <cstdio>
+
+#include <memory>
+
+using namespace linux;
+using namespace std;
+
+struct object {
+    int id;
+};
+
+int main(int argc, char *argv[]) {
+    auto node = numa::current_node();
+    assert(node >= 0);
+    auto cpus = numa::cpus_of_node(node);
+    if(cpus.empty()) {
+        printf("no NUMA topology exposed, skip topology checks\n");
+    } else {
+        assert(numa::node_of_cpu(cpus.front()) == node);
+        assert(numa::bind_thread_to_node(pthread_self(), node));
+        assert(numa::current_node() == node);
+        printf("topology passed, node %d has %zu cpus\n", node, cpus.size());
+    }
+    assert(numa::cpus_of_node(1 << 20).empty());
+    assert(!numa::bind_thread_to_node(pthread_self(), 1 << 20));
+
+    // rounded to pages, zeroed, placement reported
+    numa::buffer local(100);
+    assert(local.size() == numa::page_size());
+    assert(local.placed());
+    assert(static_cast<char*>(local.get())[0] == 0);
+    numa::buffer bound(3 * numa::page_size() + 1, node);
+    assert(bound.size() == 4 * numa::page_size());
+    if(!cpus.empty()) {
+        assert(bound.placed());
+    }
+    numa::buffer missing(100, 1000);
+    assert(!missing.placed());
+    // huge pages fall back to normal pages when none are reserved
+    numa::buffer huge(100, -1, true);
+    assert(huge.size() == numa::HUGE_PAGE_BYTES);
+    static_cast<char*>(huge.get())[huge.size() - 1] = 1;
+    auto moved = move(huge);
+    assert(moved.size() == numa::HUGE_PAGE_BYTES && huge.get() == nullptr);
+    printf("buffer passed, huge pages %s\n", moved.huge_pages() ? "reserved" : "not reserved");
+
+    // heap allocated queues on a node
+    unique_ptr<linux::queue::sr_sw_queue<object>> sw(new linux::queue::sr_sw_queue<object>(node, true));
+    unique_ptr<linux::queue::sr_mw_queue<object>> mw(new linux::queue::sr_mw_queue<object>(node));
+    object o{42};
+    object* p = nullptr;
+    assert(!sw->remove(p));
+    assert(sw->add(&o) && sw->remove(p) && p->id == 42);
+    assert(mw->add(&o) && mw->remove(p) && p->id == 42);
+    printf("queues passed, placed %d %d\n", sw->placed(), mw->placed());
+    return 0;
+}
@@ -0,0 +1,232 @@
+// ../run spill_queue
+#include "spill_queue.hxx"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace linux::queue;
+using namespace std;
+
+constexpr size_t SMALL_SEGMENT = 8192;
+
+vector<string> segment_files(const string& dir) {
+    vector<string> files;
+    auto d = opendir(dir.c_str());
+    assert(d != nullptr);
+    while(auto entry = readdir(d)) {
+        if(entry->d_name[0] != '.') {
+            files.push_back(dir + "/" + entry->d_name);
+        }
+    }
+    closedir(d);
+    return files;
+}
+
+void remove_directory(const string& dir) {
+    for(auto& file: segment_files(dir)) {
+        unlink(file.c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+string make_directory() {
+    char name[] = "/tmp/spill_queue_test.XXXXXX";
+    assert(mkdtemp(name) != nullptr);
+    return name;
+}
+
+struct record {
+    int id;
+    char filler[96];
+};
+
+void add_records(spill_queue& q, int first, int last) {
+    for(auto id = first; id < last; ++id) {
+        record r;
+        memset(&r, 0, sizeof(r));
+        r.id = id;
+        q.add(&r, sizeof(r));
+    }
+}
+
+int pop_record(spill_queue& q) {
+    const void* data = nullptr;
+    uint32_t size = 0;
+    assert(q.front(data, size));
+    assert(size == sizeof(record));
+    auto id = static_cast<const record*>(data)->id;
+    q.pop();
+    return id;
+}
+
+void test_rollover_and_reopen() {
+    auto dir = make_directory();
+    {
+        spill_queue q(dir, SMALL_SEGMENT);
+        add_records(q, 0, 2000);
+        // about 70 records per segment
+        assert(segment_files(dir).size() > 20);
+        for(auto id = 0; id < 500; ++id) {
+            assert(pop_record(q) == id);
+        }
+    }
+    {
+        // the partly consumed segment resumes after the last pop
+        spill_queue q(dir, SMALL_SEGMENT);
+        for(auto id = 500; id < 2000; ++id) {
+            assert(pop_record(q) == id);
+        }
+        const void* data = nullptr;
+        uint32_t size = 0;
+        assert(!q.front(data, size));
+        // appending after a recovery starts a new segment
+        add_records(q, 2000, 2010);
+        for(auto id = 2000; id < 2010; ++id) {
+            assert(pop_record(q) == id);
+        }
+        assert(!q.front(data, size));
+    }
+    remove_directory(dir);
+    printf("rollover and reopen passed\n");
+}
+
+void test_corrupt_tail() {
+    auto dir = make_directory();
+    {
+        spill_queue q(dir, SMALL_SEGMENT);
+        add_records(q, 0, 10);
+    }
+    auto files = segment_files(dir);
+    assert(files.size() == 1);
+    // a torn write of the last record, its length reached the disk but not its payload
+    auto fd = open(files.front().c_str(), O_RDWR);
+    assert(fd >= 0);
+    // header of 64 bytes, records of an 8 bytes header and a padded payload
+    auto stride = 8 + ((sizeof(record) + 7) & ~static_cast<size_t>(7));
+    auto last_payload = 64 + 9 * stride + 8;
+    char garbage[4] = {'t', 'o', 'r', 'n'};
+    assert(pwrite(fd, garbage, sizeof(garbage), last_payload + 20) == sizeof(garbage));
+    close(fd);
+    {
+        spill_queue q(dir, SMALL_SEGMENT);
+        for(auto id = 0; id < 9; ++id) {
+            assert(pop_record(q) == id);
+        }
+        const void* data = nullptr;
+        uint32_t size = 0;
+        assert(!q.front(data, size));
+    }
+    remove_directory(dir);
+    printf("corrupt tail passed\n");
+}
+
+void check_empty_record(spill_queue& q) {
+    const void* data = nullptr;
+    uint32_t size = 0;
+    assert(q.front(data, size) && size == 1 && memcmp(data, "a", 1) == 0);
+    q.pop();
+    assert(q.front(data, size) && size == 0);
+    q.pop();
+    assert(q.front(data, size) && size == 2 && memcmp(data, "bc", 2) == 0);
+    q.pop();
+    assert(!q.front(data, size));
+}
+
+void test_empty_record() {
+    auto dir = make_directory();
+    {
+        spill_queue q(dir, SMALL_SEGMENT);
+        q.add("a", 1);
+        q.add("", 0);
+        q.add("bc", 2);
+        // a record of zero bytes is not the unwritten tail
+        check_empty_record(q);
+        q.add("a", 1);
+        q.add("", 0);
+        q.add("bc", 2);
+    }
+    {
+        // nor is it the end of the recovered records
+        spill_queue q(dir, SMALL_SEGMENT, durability::always);
+        check_empty_record(q);
+    }
+    {
+        spill_queue q(dir, SMALL_SEGMENT, durability::always);
+        q.add("a", 1);
+        q.add("", 0);
+        q.add("bc", 2);
+    }
+    {
+        spill_queue q(dir, SMALL_SEGMENT);
+        check_empty_record(q);
+        auto thrown = false;
+        try {
+            q.reserve(0xfffffffe);
+        } catch(const spill_queue_exception& e) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            q.reserve(SMALL_SEGMENT);
+        } catch(const spill_queue_exception& e) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    remove_directory(dir);
+    printf("empty record passed\n");
+}
+
+constexpr int CONCURRENT_RECORDS = 100000;
+
+void* producer(void* arg) {
+    auto q = static_cast<spill_queue*>(arg);
+    add_records(*q, 0, CONCURRENT_RECORDS);
+    return nullptr;
+}
+
+void test_concurrent(size_t segment_size, durability level, const char* name) {
+    auto dir = make_directory();
+    {
+        spill_queue q(dir, segment_size, level);
+        pthread_t thread;
+        assert(0 == pthread_create(&thread, nullptr, producer, &q));
+        const void* data = nullptr;
+        uint32_t size = 0;
+        for(auto id = 0; id < CONCURRENT_RECORDS;) {
+            if(!q.front(data, size)) {
+                continue;
+            }
+            assert(size == sizeof(record) && static_cast<const record*>(data)->id == id);
+            q.pop();
+            ++id;
+        }
+        pthread_join(thread, nullptr);
+        assert(!q.front(data, size));
+    }
+    remove_directory(dir);
+    printf("concurrent %s passed, %d records\n", name, CONCURRENT_RECORDS);
+}
+
+int main(int argc, char *argv[]) {
+    test_rollover_and_reopen();
+    test_corrupt_tail();
+    test_empty_record();
+    test_concurrent(16 * SMALL_SEGMENT, durability::none, "without sync");
+    // the writer syncs every end marker while the reader drops segments
+    test_concurrent(SMALL_SEGMENT, durability::batched, "batched");
+    return 0;
+}